@@ -0,0 +1,137 @@
+/**
+# Performance reporting
+
+This file can be included (after the solver headers) by a test case
+to report the performance of the [multilayer solver](hydro.h) in a
+machine-readable form. At the end of the run, one line (a JSON object)
+is appended to *benchmark_file* by the master process, with:
+
+* the name of the case (*benchmark_name*), the maximum level, the
+  number of layers, whether the [non-hydrostatic solver](nh.h) is used
+  and the numbers of processes and threads,
+* the number of timesteps, the wall-clock time per timestep and the
+  speed (in cells.timesteps per second),
+* the average number of multigrid (or Krylov) iterations per timestep
+  of the [Poisson--Helmholtz](implicit.h) and non-hydrostatic
+  solvers,
+* the peak memory (resident set size, maximum over processes, in
+  kilobytes),
+* an accuracy metric, given by the function *benchmark_error()*
+  (typically the error relative to a reference solution), if it is
+  defined by the test case. If the error is larger than
+  *benchmark_tolerance* (or is not a number), the run exits with an
+  error status (after writing the record), so that the case can also
+  be used as a regression test.
+
+Running the same case for different levels, numbers of layers,
+processes and threads gives a record which can be compared between
+versions. This is done by [benchmarks/sweep.sh](benchmarks/sweep.sh)
+for the following cases:
+
+* [the decay of a capillary wave](benchmarks/capwave.c) with [surface
+  tension](hydro-tension.h),
+* [the rupture of a thin film](benchmarks/rupture.c) with [van der
+  Waals forces](van-der-waals.h),
+* [a Marangoni flow](benchmarks/marangoni.c),
+* [the viscous damping of a long wave](benchmarks/viscous.c) with the
+  [surface viscous stress](viscous_surface.h),
+* [a standing wave](benchmarks/standing.c) with the [non-hydrostatic
+  solver](nh.h),
+* [the fluxes through sections](benchmarks/fluxes.c), using the
+  [cached stencils](hydro.h#fluxes-through-sections). */
+
+#include <sys/resource.h>
+
+char * benchmark_name = "benchmark";
+char * benchmark_file = "benchmark.json";
+double (* benchmark_error) (void) = NULL;
+double benchmark_tolerance = HUGE;
+
+static timer benchmark_clock;
+static long benchmark_steps = 0;
+static double benchmark_cells = 0., benchmark_mgH = 0., benchmark_mgp = 0.;
+
+event init (i = 0)
+{
+  benchmark_clock = timer_start();
+}
+
+/**
+The number of cells and of solver iterations are accumulated at the
+end of each timestep. */
+
+event benchmark_step (i++)
+{
+  benchmark_cells += grid->tn;
+#ifdef IMPLICIT_H
+  benchmark_mgH += mgH.i;
+#endif
+#if NH
+  benchmark_mgp += mgp.i;
+#endif
+  benchmark_steps++;
+}
+
+event benchmark_report (t = end)
+{
+  double elapsed = timer_elapsed (benchmark_clock);
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  long mem = usage.ru_maxrss;
+  int npes = 1;
+#if _MPI
+  MPI_Allreduce (MPI_IN_PLACE, &mem, 1, MPI_LONG, MPI_MAX, MPI_COMM_WORLD);
+  npes = npe();
+#endif
+  double error = benchmark_error ? benchmark_error() : nodata;
+  if (pid() == 0) {
+    FILE * fp = fopen (benchmark_file, "a");
+    if (!fp) {
+      perror (benchmark_file);
+      exit (1);
+    }
+    double n = max (benchmark_steps, 1);
+    fprintf (fp, "{\"name\": \"%s\", \"level\": %d, \"nl\": %d, "
+	     "\"nh\": %s, \"ranks\": %d, \"threads\": %d, "
+	     "\"steps\": %ld, \"time_per_step\": %g, "
+	     "\"speed\": %g, \"mgH\": %g, \"mgp\": %g, "
+	     "\"peak_memory\": %ld",
+	     benchmark_name, grid->maxdepth, nl,
+	     hydrostatic ? "false" : "true", npes, layered_nthreads(),
+	     benchmark_steps, elapsed/n,
+	     elapsed > 0. ? benchmark_cells/elapsed : 0.,
+	     benchmark_mgH/n, benchmark_mgp/n, mem);
+    if (error != nodata)
+      fprintf (fp, ", \"error\": %g", error);
+    fputs ("}\n", fp);
+    fclose (fp);
+  }
+
+  /**
+  If *BENCHMARK_FIELDS* is defined (as a file name), the final
+  surface elevation, layer thicknesses and velocities are also written
+  (in a fixed order and with all their digits), so that runs with
+  different numbers of threads can be compared exactly (see
+  [threads.sh](benchmarks/threads.sh)). */
+
+#if defined(BENCHMARK_FIELDS) && !_MPI
+  FILE * fp = fopen (BENCHMARK_FIELDS, "w");
+  foreach (serial) {
+    fprintf (fp, "%.17g %.17g %.17g", x, y, eta[]);
+    foreach_layer() {
+      fprintf (fp, " %.17g", h[]);
+      foreach_dimension()
+	fprintf (fp, " %.17g", u.x[]);
+    }
+    fputc ('\n', fp);
+  }
+  fclose (fp);
+#endif
+
+  if (error != nodata && !(error <= benchmark_tolerance)) {
+    if (pid() == 0)
+      fprintf (stderr, "%s: error %g is larger than the tolerance %g\n",
+	       benchmark_name, error, benchmark_tolerance);
+    exit (1);
+  }
+}
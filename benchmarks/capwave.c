@@ -0,0 +1,102 @@
+/**
+# Decay of a capillary wave
+
+A standing capillary wave of wavelength $\lambda$ and small amplitude
+$a_0$ oscillates on a layer of (free-slip) depth $h_0$, with surface
+tension $\sigma$, no gravity and a small viscosity $\nu$. For $kh_0
+\ll 1$ and a free-slip bottom, the velocity is nearly uniform over
+the depth and the linear evolution of the surface is that of a damped
+oscillator
+$$
+\partial_{tt}\eta + 4\nu k^2\partial_t\eta + \omega_0^2\eta = 0,
+\quad \omega_0^2 = \frac{\sigma}{\rho} k^3 \tanh(kh_0)
+$$
+where $4\nu$ is the extensional (Trouton) viscosity of the layer,
+given by the [surface viscous stress](../viscous_surface.h) and the
+horizontal diffusion, and where $\tanh(kh_0)$ is replaced by $kh_0$
+for the hydrostatic solver. The accuracy metric is the maximum (over
+space and time) of the difference between the surface elevation and
+this solution, relative to $a_0$. The run fails if it is larger than
+20%, a bound well above the expected discretisation and modelling
+errors, so that a wrong surface stress (for example in
+non-hydrostatic runs with several layers) is detected.
+
+The case is run with the (level, number of layers, Krylov solver)
+given on the command line, and with the [non-hydrostatic
+solver](../nh.h) if *BENCH_NH* is set, see [sweep.sh](sweep.sh). */
+
+#include "grid/multigrid1D.h"
+#ifndef BENCH_NH
+# define BENCH_NH 0
+#endif
+#define CAP_IMPLICIT 1
+#include "layered/hydro-tension.h"
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/implicit.h"
+#endif
+#include "layered/viscous_surface.h"
+#include "layered/benchmark.h"
+
+double h0 = 0.1, a0 = 1e-3, k = 2.*pi, omega0, gamma0, T0;
+
+double capwave_ref (double x, double t)
+{
+  double omega = sqrt (sq(omega0) - sq(gamma0));
+  return h0 + a0*cos(k*x)*exp(-gamma0*t)*(cos(omega*t) +
+					  gamma0/omega*sin(omega*t));
+}
+
+static double capwave_err = 0.;
+
+double capwave_error (void)
+{
+  return capwave_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 4;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  N = 1 << level;
+  periodic (right);
+  G = 0.;
+  nu = 1e-3;
+  h_diffusion = true;
+  omega0 = sqrt (cube(k)*(BENCH_NH ? tanh(k*h0) : k*h0));
+  gamma0 = 2.*nu*sq(k);
+  T0 = 2.*pi/omega0;
+  DT = T0/100.;
+  benchmark_name = "capwave";
+  benchmark_error = capwave_error;
+  benchmark_tolerance = 0.2;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach() {
+    double H = capwave_ref (x, 0.);
+    foreach_layer()
+      h[] = H/nl;
+  }
+}
+
+event error (i++)
+{
+  double e = 0.;
+  foreach (reduction(max:e)) {
+    double d = fabs (eta[] - capwave_ref (x, t));
+    if (d > e)
+      e = d;
+  }
+  if (e/a0 > capwave_err)
+    capwave_err = e/a0;
+}
+
+event end (t = 2.*T0)
+{
+  fprintf (stderr, "capwave: %d %d %g\n", N, nl, capwave_err);
+}
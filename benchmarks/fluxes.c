@@ -0,0 +1,107 @@
+/**
+# Cached flux stencils on a fixed tree grid
+
+A uniform flow $(U, V)$ in a layer of depth $h_0$ is advected in a
+periodic box, on a (non-adapted) quadtree. The fluxes through three
+sections are computed at each timestep by
+[output_fluxes()](../hydro.h#fluxes-through-sections), with the
+cached stencils. Since the grid does not change (which is declared by
+setting *grid_static*), the stencils must be computed only once: the
+case fails otherwise. The accuracy metric is
+the maximum difference between the cached fluxes and those of
+*segment_flux()*, relative to the exact flux $h_0(U, V)\cdot\mathbf{n}
+l$. */
+
+#include "grid/quadtree.h"
+#ifndef BENCH_NH
+# define BENCH_NH 0
+#endif
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/hydro.h"
+# include "layered/implicit.h"
+#endif
+#include "layered/benchmark.h"
+
+double h0 = 1., U = 1., V = 0.5;
+
+Flux fluxes[] = {
+  {"flux-x", {{0.1234, -0.5}, {0.1234, 0.5}}},
+  {"flux-y", {{-0.5, -0.2345}, {0.5, -0.2345}}},
+  {"flux-d", {{-0.3, -0.4}, {0.35, 0.25}}},
+  {NULL}
+};
+
+static double fluxes_err = 0.;
+
+double fluxes_error (void)
+{
+  return fluxes_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 4;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  origin (-0.5, -0.5);
+  periodic (right);
+  periodic (top);
+  init_grid (1 << level);
+  grid_static = true;
+  flux_cache = true;
+  flux_binary = true;
+  benchmark_name = "fluxes";
+  benchmark_error = fluxes_error;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach()
+    foreach_layer() {
+      h[] = h0/nl;
+      u.x[] = U, u.y[] = V;
+    }
+}
+
+event output (i++)
+{
+  output_fluxes (fluxes, h, u);
+  for (Flux * f = fluxes; f->name; f++) {
+    if (f->builds != 1) {
+      fprintf (stderr, "fluxes: %s: the stencils have been computed %d times\n",
+	       f->name, f->builds);
+      exit (1);
+    }
+
+    /**
+    The cached fluxes are summed again (in the same way as
+    *output_fluxes()*) to be compared with those of *segment_flux()*
+    and with the exact value. */
+    
+    double flux[nl], cached[nl];
+    for (int l = 0; l < nl; l++)
+      cached[l] = 0.;
+    flux_stencils_sum (f, cached, h, u);
+#if _MPI
+    MPI_Allreduce (MPI_IN_PLACE, cached, nl, MPI_DOUBLE, MPI_SUM,
+		   MPI_COMM_WORLD);
+#endif
+    double tot = segment_flux (f->s, flux, h, u), totc = 0.;
+    for (int l = 0; l < nl; l++)
+      totc += cached[l];
+    coord d = {f->s[1].x - f->s[0].x, f->s[1].y - f->s[0].y};
+    double ref = h0*(V*d.x - U*d.y);
+    double e = max (fabs (totc - tot), fabs (totc - ref))/fabs (ref);
+    if (e > fluxes_err)
+      fluxes_err = e;
+  }
+}
+
+event end (i = 20)
+{
+  free_fluxes (fluxes);
+  fprintf (stderr, "fluxes: %d %g\n", N, fluxes_err);
+}
@@ -0,0 +1,92 @@
+/**
+# Marangoni flow in a thin film
+
+The surface tension of a layer of depth $h_0$ (with a free-slip
+bottom) varies as $\sigma = \sigma_0 + \delta\cos(kx)$. The
+[Marangoni stress](../hydro-tension.h#marangoni-stress) (imposed
+through *du_Mrg*) drives a surface flow towards the regions of large
+surface tension, which is balanced (for $kh_0 \ll 1$ and $\delta \ll
+\sigma_0$) by the hydrostatic and Laplace pressure gradients of a
+surface deformation
+$$
+\eta = h_0 + \frac{\delta}{\rho h_0(g + \sigma_0k^2/\rho)}\cos(kx)
+$$
+In this steady state, the (lubrication) velocity profile has a zero
+flux, a free-slip bottom and the imposed stress at the surface
+$$
+u(z) = \frac{\partial_x\sigma}{\rho\nu h_0}\left(\frac{z^2}{2} -
+\frac{h_0^2}{6}\right)
+$$
+The surface elevation is initialised with its steady value (so that
+no gravity wave is generated) and the fluid is initially at rest. The
+accuracy metric is the maximum difference (over cells and layers) with
+the profile above at $t = 10h_0^2/\nu$, relative to the surface
+velocity $\delta kh_0/(3\nu)$. */
+
+#include "grid/multigrid1D.h"
+#ifndef BENCH_NH
+# define BENCH_NH 0
+#endif
+#define CAP_IMPLICIT 1
+#include "layered/hydro-tension.h"
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/implicit.h"
+#endif
+#include "layered/benchmark.h"
+
+double h0 = 1., delta = 1e-2, k;
+
+scalar sigma_m[];
+
+static double marangoni_err = nodata;
+
+double marangoni_error (void)
+{
+  return marangoni_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 8;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  N = 1 << level;
+  L0 = 20.;
+  periodic (right);
+  k = 2.*pi/L0;
+  nu = 1.;
+  sigma = sigma_m;
+  DT = 0.01*sq(h0)/nu;
+  benchmark_name = "marangoni";
+  benchmark_error = marangoni_error;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach() {
+    sigma_m[] = 1. + delta*cos(k*x);
+    double H = h0 + delta/(rhom*h0*(G + sq(k)/rhom))*cos(k*x);
+    foreach_layer()
+      h[] = H/nl;
+  }
+}
+
+event end (t = 10.*sq(h0)/nu)
+{
+  double e = 0.;
+  foreach (reduction(max:e)) {
+    double sx = - delta*k*sin(k*x), z = zb[];
+    foreach_layer() {
+      z += h[]/2.;
+      double d = fabs (u.x[] - sx/(rhom*nu*h0)*(sq(z)/2. - sq(h0)/6.));
+      if (d > e)
+	e = d;
+      z += h[]/2.;
+    }
+  }
+  marangoni_err = e/(delta*k*h0/(3.*nu));
+  fprintf (stderr, "marangoni: %d %d %g\n", N, nl, marangoni_err);
+}
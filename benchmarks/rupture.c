@@ -0,0 +1,85 @@
+/**
+# Rupture of a thin film
+
+A film of thickness $h_0$, with surface tension $\sigma$ and a
+disjoining pressure given by [van der Waals forces](../van-der-waals.h)
+with a Hamaker constant $A$, is perturbed by a small sinusoidal
+perturbation of wavenumber $k$. Without viscosity (and with $kh_0 \ll
+1$), the linear evolution of the layer is
+$$
+\partial_{tt}\eta = h_0\partial_{xx}\left(g\eta - \frac{3A}{8h_0^4}\eta
+- \frac{\sigma}{\rho}\partial_{xx}\eta\right)
+$$
+so that, for $3A/(8h_0^4) > g + \sigma k^2/\rho$, the perturbation
+grows (starting from rest) as $\cosh(st)$ with
+$$
+s^2 = h_0k^2\left(\frac{3A}{8h_0^4} - g - \frac{\sigma}{\rho}k^2\right)
+$$
+The accuracy metric is the relative error on the amplitude of the
+mode at $t = 5/s$ (i.e. for an amplification of about 74). */
+
+#include "grid/multigrid1D.h"
+#ifndef BENCH_NH
+# define BENCH_NH 0
+#endif
+#define CAP_IMPLICIT 1
+#define VDW_IMPLICIT 1
+#include "layered/van-der-waals.h"
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/implicit.h"
+#endif
+#include "layered/benchmark.h"
+
+double h0 = 1., a0 = 1e-5, k, s0;
+
+/**
+The amplitude of the mode is obtained by projection on $\cos(kx)$. */
+
+static double amplitude (void)
+{
+  double A = 0.;
+  foreach (reduction(+:A))
+    A += (eta[] - h0)*cos(k*x)*Delta;
+  return 2.*A/L0;
+}
+
+static double rupture_err = nodata;
+
+double rupture_error (void)
+{
+  return rupture_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 4;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  N = 1 << level;
+  L0 = 20.;
+  periodic (right);
+  k = 2.*pi/L0;
+  HAM = 16./3.;
+  s0 = sqrt (h0*sq(k)*(3.*HAM/(8.*sq(sq(h0))) - G - sq(k)));
+  DT = 0.05/s0;
+  benchmark_name = "rupture";
+  benchmark_error = rupture_error;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach() {
+    double H = h0 + a0*cos(k*x);
+    foreach_layer()
+      h[] = H/nl;
+  }
+}
+
+event end (t = 5./s0)
+{
+  rupture_err = fabs (amplitude()/(a0*cosh(s0*t)) - 1.);
+  fprintf (stderr, "rupture: %d %d %g\n", N, nl, rupture_err);
+}
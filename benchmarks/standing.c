@@ -0,0 +1,83 @@
+/**
+# Non-hydrostatic standing wave
+
+A standing gravity wave of wavelength $\lambda = 1$ and small
+amplitude $a_0$ oscillates (without viscosity) on a layer of depth
+$h_0 = 1/2$. For $kh_0 = \pi$, dispersion is important and the linear
+solution
+$$
+\eta = h_0 + a_0\cos(kx)\cos(\omega t), \quad \omega^2 = gk\tanh(kh_0)
+$$
+is only recovered by the [non-hydrostatic solver](../nh.h), with
+enough layers. The accuracy metric is the maximum difference (over
+space and two periods) with this solution, relative to $a_0$. Since
+the case is also run with the hydrostatic solver by
+[sweep.sh](sweep.sh), the corresponding (shallow-water) relation
+$\omega^2 = gk^2h_0$ is used in this case. */
+
+#include "grid/multigrid1D.h"
+#ifndef BENCH_NH
+# define BENCH_NH 1
+#endif
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/hydro.h"
+# include "layered/implicit.h"
+#endif
+#include "layered/benchmark.h"
+
+double h0 = 0.5, a0 = 1e-3, k = 2.*pi, omega0, T0;
+
+double standing_ref (double x, double t)
+{
+  return h0 + a0*cos(k*x)*cos(omega0*t);
+}
+
+static double standing_err = 0.;
+
+double standing_error (void)
+{
+  return standing_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 8;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  N = 1 << level;
+  periodic (right);
+  omega0 = sqrt (G*k*(BENCH_NH ? tanh(k*h0) : k*h0));
+  T0 = 2.*pi/omega0;
+  DT = T0/100.;
+  benchmark_name = "standing";
+  benchmark_error = standing_error;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach() {
+    double H = standing_ref (x, 0.);
+    foreach_layer()
+      h[] = H/nl;
+  }
+}
+
+event error (i++)
+{
+  double e = 0.;
+  foreach (reduction(max:e)) {
+    double d = fabs (eta[] - standing_ref (x, t));
+    if (d > e)
+      e = d;
+  }
+  if (e/a0 > standing_err)
+    standing_err = e/a0;
+}
+
+event end (t = 2.*T0)
+{
+  fprintf (stderr, "standing: %d %d %g\n", N, nl, standing_err);
+}
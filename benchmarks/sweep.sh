@@ -0,0 +1,61 @@
+#!/bin/sh
+# Runs the benchmark cases over levels x layers x {hydrostatic, nh}
+# x {multigrid, Krylov} x {MPI ranks, OpenMP threads}. Each run
+# appends one line to benchmark.json (see ../benchmark.h).
+#
+# Usage: sh sweep.sh [case.c ...]
+#
+# The parameters can be set through the environment, for example
+#   LEVELS="6 7" LAYERS="1 4" RANKS="1 4" THREADS="1 8" sh sweep.sh capwave.c
+# The cases are compiled (with qcc) and run in $DIR, which contains a
+# "layered" link to this repository so that it is used instead of the
+# solver of the Basilisk installation.
+
+set -e
+
+LEVELS=${LEVELS:-"6 7 8"}
+LAYERS=${LAYERS:-"1 4 16"}
+SOLVERS=${SOLVERS:-"0 1"}        # 0: multigrid, 1: Krylov
+NHS=${NHS:-"0 1"}                # 0: hydrostatic, 1: non-hydrostatic
+RANKS=${RANKS:-"1"}              # numbers of MPI processes
+THREADS=${THREADS:-"1"}          # numbers of OpenMP threads
+CFLAGS=${CFLAGS:-"-O2 -Wall"}
+MPIRUN=${MPIRUN:-"mpirun -np"}
+DIR=${DIR:-"_sweep"}
+
+src=$(cd "$(dirname "$0")" && pwd)
+cases=${*:-"capwave.c rupture.c marangoni.c viscous.c standing.c fluxes.c"}
+
+mkdir -p "$DIR"
+ln -sfn "$src/.." "$DIR/layered"
+cd "$DIR"
+
+for c in $cases; do
+    cp "$src/$(basename $c)" .
+    name=$(basename $c .c)
+    for nh in $NHS; do
+	exe=$name-nh$nh
+	qcc $CFLAGS -I. -fopenmp -DBENCH_NH=$nh $name.c -o $exe -lm
+	if [ "$RANKS" != "1" ]; then
+	    CC99='mpicc -std=c99' qcc $CFLAGS -I. -D_MPI=1 -DBENCH_NH=$nh \
+		$name.c -o $exe-mpi -lm
+	fi
+	for level in $LEVELS; do
+	    for nl in $LAYERS; do
+		for solver in $SOLVERS; do
+		    for t in $THREADS; do
+			OMP_NUM_THREADS=$t ./$exe $level $nl $solver
+		    done
+		    for r in $RANKS; do
+			if [ "$r" != "1" ]; then
+			    OMP_NUM_THREADS=1 $MPIRUN $r ./$exe-mpi \
+					   $level $nl $solver
+			fi
+		    done
+		done
+	    done
+	done
+    done
+done
+
+echo "results appended to $DIR/benchmark.json"
@@ -0,0 +1,62 @@
+#!/bin/sh
+# Strong scaling with OpenMP threads. A case (capwave.c with the
+# non-hydrostatic solver by default, which uses the vertical diffusion,
+# the surface viscous stress and the column kernels of nh.h) is run
+# with 1 thread and then with each number of $THREADS. The final
+# fields (written with all their digits, see BENCHMARK_FIELDS in
+# ../benchmark.h) must be identical to those of the single-threaded
+# run, and the speedup is computed from the time per step. The default
+# (non-hydrostatic, several layers) must also pass the accuracy check
+# of the case (see benchmark_tolerance), so that wrong but
+# reproducible results are not reported as a success.
+#
+# Usage: THREADS="2 4 8" LEVEL=9 NL=8 sh threads.sh [case.c]
+#
+# The multigrid solver is used: the sums of the Krylov solver are
+# reduced over threads in an undefined order, so that its results
+# are only reproducible to round-off.
+
+set -e
+
+THREADS=${THREADS:-"2 4 8"}
+LEVEL=${LEVEL:-"9"}
+NL=${NL:-"8"}
+NH=${NH:-"1"}
+CFLAGS=${CFLAGS:-"-O2 -Wall"}
+DIR=${DIR:-"_threads"}
+
+src=$(cd "$(dirname "$0")" && pwd)
+case=${1:-"capwave.c"}
+name=$(basename $case .c)
+
+mkdir -p "$DIR"
+ln -sfn "$src/.." "$DIR/layered"
+cd "$DIR"
+cp "$src/$name.c" .
+qcc $CFLAGS -I. -fopenmp -DBENCH_NH=$NH -DBENCHMARK_FIELDS='"fields"' \
+    $name.c -o $name -lm
+rm -f benchmark.json
+
+time_per_step() {
+    tail -n 1 benchmark.json | sed 's/.*"time_per_step": \([^,]*\),.*/\1/'
+}
+
+OMP_NUM_THREADS=1 ./$name $LEVEL $NL 0
+mv fields fields-1
+t1=$(time_per_step)
+status=0
+printf "%8s %14s %8s %s\n" threads time/step speedup fields
+printf "%8d %14g %8.2f %s\n" 1 $t1 1 reference
+for n in $THREADS; do
+    OMP_NUM_THREADS=$n ./$name $LEVEL $NL 0
+    tn=$(time_per_step)
+    if cmp -s fields-1 fields; then
+	same=identical
+    else
+	same=DIFFERENT
+	status=1
+    fi
+    printf "%8d %14g %8.2f %s\n" $n $tn $(awk "BEGIN {print $t1/$tn}") $same
+    mv fields fields-$n
+done
+exit $status
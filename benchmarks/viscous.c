@@ -0,0 +1,94 @@
+/**
+# Viscous damping of a long gravity wave
+
+A standing gravity wave of small amplitude $a_0$ is damped by
+viscosity on a thin layer (with a free-slip bottom). The velocity is
+then nearly uniform over the depth and the viscous stresses reduce to
+an extensional (Trouton) viscosity $4\nu$: $2\nu$ from the horizontal
+diffusion and the tangential [surface stress](../viscous_surface.h),
+and $2\nu$ from the normal surface stress. The linear evolution is
+that of the damped oscillator
+$$
+\partial_{tt}\eta + 4\nu k^2\partial_t\eta + \omega_0^2\eta = 0,
+\quad \omega_0^2 = gk\tanh(kh_0)
+$$
+(with $kh_0$ instead of $\tanh(kh_0)$ for the hydrostatic solver).
+
+The surface stresses are only taken into account when *visc_activate*
+is set (the default, or the fifth argument of the command line), so
+that the difference with the reference solution (the accuracy metric,
+relative to $a_0$) is much larger without them. */
+
+#include "grid/multigrid1D.h"
+#ifndef BENCH_NH
+# define BENCH_NH 0
+#endif
+#if BENCH_NH
+# include "layered/nh.h"
+#else
+# include "layered/hydro.h"
+# include "layered/implicit.h"
+#endif
+#include "layered/viscous_surface.h"
+#include "layered/benchmark.h"
+
+double h0 = 0.05, a0 = 1e-4, k = 2.*pi, omega0, gamma0, T0;
+
+double viscous_ref (double x, double t)
+{
+  double omega = sqrt (sq(omega0) - sq(gamma0));
+  return h0 + a0*cos(k*x)*exp(-gamma0*t)*(cos(omega*t) +
+					   gamma0/omega*sin(omega*t));
+}
+
+static double viscous_err = 0.;
+
+double viscous_error (void)
+{
+  return viscous_err;
+}
+
+int main (int argc, char * argv[])
+{
+  int level = argc > 1 ? atoi (argv[1]) : 7;
+  nl = argc > 2 ? atoi (argv[2]) : 4;
+  krylov = argc > 3 ? atoi (argv[3]) : false;
+  visc_activate = argc > 4 ? atoi (argv[4]) : true;
+  N = 1 << level;
+  periodic (right);
+  nu = 5e-3;
+  h_diffusion = true;
+  omega0 = sqrt (G*k*(BENCH_NH ? tanh(k*h0) : k*h0));
+  gamma0 = 2.*nu*sq(k);
+  T0 = 2.*pi/omega0;
+  DT = T0/100.;
+  benchmark_name = visc_activate ? "viscous" : "viscous-off";
+  benchmark_error = viscous_error;
+  run();
+}
+
+event init (i = 0)
+{
+  foreach() {
+    double H = viscous_ref (x, 0.);
+    foreach_layer()
+      h[] = H/nl;
+  }
+}
+
+event error (i++)
+{
+  double e = 0.;
+  foreach (reduction(max:e)) {
+    double d = fabs (eta[] - viscous_ref (x, t));
+    if (d > e)
+      e = d;
+  }
+  if (e/a0 > viscous_err)
+    viscous_err = e/a0;
+}
+
+event end (t = 2.*T0)
+{
+  fprintf (stderr, "viscous: %d %d %g\n", N, nl, viscous_err);
+}
@@ -30,17 +30,56 @@ $$ */
 
 bool h_diffusion = false;
 
-void vertical_diffusion_NeumanNeuman (Point point, scalar h, scalar s, double dt, double D,
-				        double dst, double dsb)
+/**
+The diagonals of the system only depend on the layer thicknesses and
+on the boundary closure, so that they can be shared by all the fields
+diffused within a column. The assembly of $\mathbf{M}$ and the forward
+elimination of the [Thomas
+algorithm](https://en.wikipedia.org/wiki/Tridiagonal_matrix_algorithm)
+are thus done once (by *vertical_diffusion_factor()*) and the
+substitution is done for each field (by *vertical_diffusion_solve()*).
+
+The boundary closures are identified by: */
+
+enum {
+  vd_NeumanNeuman, // Neumann on the free-surface and on the bottom
+  vd_NeumanNavier, // Neumann on the free-surface, Navier slip on the bottom
+  vd_NavierNavier  // Navier slip on the free-surface and on the bottom
+};
+
+/**
+The closures are computed on a copy of the column, stored with a
+stride *m* (i.e. entry $l$ of the column is `h[l*m]`), so that they
+can be shared by the single-column functions (with a unit stride) and
+by the [batched solver](#batched-solver) below. The indices of the
+layers next to the boundaries are clamped for a single layer. */
+
+#define _vd_1(m) ((NLAYERS > 1 ? 1 : 0)*(m))
+#define _vd_t(m) ((NLAYERS - 1)*(m))
+#define _vd_u(m) ((NLAYERS > 1 ? NLAYERS - 2 : 0)*(m))
+
+/**
+The determinants of the third-order discretisation of the Navier slip
+conditions (see below) are used both by the matrix and by the
+right-hand-side. */
+
+static inline double vd_den_b (const double * h, int m, double lambda_b)
 {
-  double a[nl], b[nl], c[nl], rhs[nl];
+  double h0 = h[0], h1 = h[_vd_1(m)];
+  return h0*sq(h0 + h1) + 2.*lambda_b*(3.*h0*h1 + 2.*sq(h0) + sq(h1));
+}
 
-  /**
-  The *rhs* of the tridiagonal system is $h_l s_l$. */
-      
-  foreach_layer()
-    rhs[_layer] = s[]*h[];
+static inline double vd_den_t (const double * h, int m, double lambda_t)
+{
+  double ht = h[_vd_t(m)], hn = h[_vd_u(m)];
+  return ht*sq(h[0] + hn) + 2.*lambda_t*(3.*ht*hn + 2.*sq(ht) + sq(hn));
+}
 
+static void vd_matrix (const double * h, int m, double dt, double D,
+		       int bc, double lambda_t, double lambda_b,
+		       double * a, double * b, double * c)
+{
+  
   /**
   The lower, principal and upper diagonals $a$, $b$ and $c$ are given by
   $$
@@ -55,17 +94,15 @@ void vertical_diffusion_NeumanNeuman (Point point, scalar h, scalar s, double dt
   $$
   */
 
-  for (int l = 1; l < nl - 1; l++) {
-    a[l] = - 2.*D*dt/(h[0,0,l-1] + h[0,0,l]);
-    c[l] = - 2.*D*dt/(h[0,0,l] + h[0,0,l+1]);
-    b[l] = h[0,0,l] - a[l] - c[l];
-    //fprintf(stderr,"%g ",dt);
+  for (int l = 1; l < NLAYERS - 1; l++) {
+    a[l*m] = - 2.*D*dt/(h[(l-1)*m] + h[l*m]);
+    c[l*m] = - 2.*D*dt/(h[l*m] + h[(l+1)*m]);
+    b[l*m] = h[l*m] - a[l*m] - c[l*m];
   }
-  //fprintf(stderr,"\n");
     
   /**
-  For the top layer the boundary conditions give the (ghost)
-  boundary value
+  For a Neumann condition on the top layer the boundary conditions give
+  the (ghost) boundary value
   $$
   s_{\mathrm{nl}} = s_{\mathrm{nl} - 1} + \dot{s}_t h_{\mathrm{nl} - 1},
   $$
@@ -78,11 +115,21 @@ void vertical_diffusion_NeumanNeuman (Point point, scalar h, scalar s, double dt
   \mathrm{rhs}_{\mathrm{nl} - 1} = 
   (hs)_{\mathrm{nl} - 1}^{\star} + D \Delta t \dot{s}_t
   $$
-  */
+  The Navier slip condition on the top layer is the symmetric of that
+  on the bottom layer (see below). */
 
-  a[nl-1] = - 2.*D*dt/(h[0,0,nl-2] + h[0,0,nl-1]);
-  b[nl-1] = h[0,0,nl-1] - a[nl-1];
-  rhs[nl-1] += D*dt*dst;
+  int t = _vd_t(m);
+  double ht = h[t], hn = h[_vd_u(m)];
+  if (bc == vd_NavierNavier) {
+    double den_t = vd_den_t (h, m, lambda_t);
+    a[t] = + 2.*dt*D*(1./(ht + hn) + sq(ht)/den_t);
+    b[t] = h[0] - 2.*dt*D*(1./(ht + hn) +
+			   (sq(hn) + 3.*ht*hn + 3.*sq(ht))/den_t);
+  }
+  else {
+    a[t] = - 2.*D*dt/(hn + ht);
+    b[t] = ht - a[t];
+  }
 
   /**
   For the bottom layer a third-order discretisation of the Navier slip
@@ -98,244 +145,395 @@ void vertical_diffusion_NeumanNeuman (Point point, scalar h, scalar s, double dt
   \det & = h_0 (h_0 + h_1)^2  + 2\lambda (3\,h_0 h_1 + 2\,h_0^2 + h_1^2),
   \end{aligned}
   $$
-  */
-  /**
-
-  double den = h[]*sq(h[] + h[0,0,1]) 
-    + 2.*lambda_b*(3.*h[]*h[0,0,1] + 2.*sq(h[]) + sq(h[0,0,1]));
-  b[0] = h[] + 2.*dt*D*(1./(h[] + h[0,0,1]) +
-			  (sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 3.*sq(h[]))/den);
-  c[0] = - 2.*dt*D*(1./(h[] + h[0,0,1]) + sq(h[])/den);
-  rhs[0] += 2.*dt*D*s_b*(sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 2.*sq(h[0]))/den;
-  */
+  while the Neumann condition is the symmetric of that on the top
+  layer. */
 
-  c[0]=- 2.*D*dt/(h[0,0,0] + h[0,0,1]);
-  b[0]= h[] - c[0];
-  rhs[0] -= D*dt*dsb;
+  double h0 = h[0], h1 = h[_vd_1(m)];
+  if (bc == vd_NeumanNeuman) {
+    c[0] = - 2.*D*dt/(h0 + h1);
+    b[0] = h0 - c[0];
+  }
+  else {
+    double den = vd_den_b (h, m, lambda_b);
+    b[0] = h0 + 2.*dt*D*(1./(h0 + h1) +
+			 (sq(h1) + 3.*h0*h1 + 3.*sq(h0))/den);
+    c[0] = - 2.*dt*D*(1./(h0 + h1) + sq(h0)/den);
+  }
 
   //TO DO change Bc for 1 Layer
-  if (nl == 1) {
+  if (NLAYERS == 1 && bc != vd_NavierNavier)
     b[0] += c[0];
-    rhs[0] += (- c[0]*h[] - D*dt) * dst;
-  }
-    
-  /**
-  We can now solve the tridiagonal system using the [Thomas
-  algorithm](https://en.wikipedia.org/wiki/Tridiagonal_matrix_algorithm). */
-  
-  for (int l = 1; l < nl; l++) {
+}
+
+/**
+The boundary terms are added to the right-hand-side *rhs*, which must
+contain $h_l s_l$ for each layer. Note that *c* is the (unmodified)
+upper diagonal. */
+
+static void vd_rhs (const double * h, int m, double dt, double D,
+		    int bc, double st, double lambda_t,
+		    double sb, double lambda_b,
+		    const double * c, double * rhs)
+{
+  int t = _vd_t(m);
+  double ht = h[t], hn = h[_vd_u(m)];
+  if (bc == vd_NavierNavier)
+    rhs[t] -= 2.*dt*D*st*(sq(hn) + 3.*ht*hn + 2.*sq(ht))/
+      vd_den_t (h, m, lambda_t);
+  else
+    rhs[t] += D*dt*st;
+
+  double h0 = h[0], h1 = h[_vd_1(m)];
+  if (bc == vd_NeumanNeuman)
+    rhs[0] -= D*dt*sb;
+  else
+    rhs[0] += 2.*dt*D*sb*(sq(h1) + 3.*h0*h1 + 2.*sq(h0))/
+      vd_den_b (h, m, lambda_b);
+
+  if (NLAYERS == 1 && bc != vd_NavierNavier)
+    rhs[0] += (- c[0]*h0 - D*dt) * st;
+}
+
+/**
+The functions below assemble the matrix and do the part of the
+forward elimination of the Thomas algorithm which does not depend on
+the right-hand-side... */
+
+void vertical_diffusion_factor (Point point, scalar h, double dt, double D,
+				int bc, double lambda_t, double lambda_b,
+				double * a, double * b, double * c)
+{
+  double hc[NLAYERS];
+  foreach_layer()
+    hc[_layer] = h[];
+  vd_matrix (hc, 1, dt, D, bc, lambda_t, lambda_b, a, b, c);
+  for (int l = 1; l < NLAYERS; l++)
     b[l] -= a[l]*c[l-1]/b[l-1];
-    //fprintf(stderr,"%g ",b[l]);
+}
+
+/**
+... and finish the elimination and do the back substitution for field
+*s*. */
+
+void vertical_diffusion_solve (Point point, scalar h, scalar s, double dt, double D,
+			       int bc, double st, double lambda_t,
+			       double sb, double lambda_b,
+			       const double * a, const double * b, const double * c)
+{
+  double hc[NLAYERS], rhs[NLAYERS];
+  foreach_layer()
+    hc[_layer] = h[], rhs[_layer] = s[]*h[];
+  vd_rhs (hc, 1, dt, D, bc, st, lambda_t, sb, lambda_b, c, rhs);
+  for (int l = 1; l < NLAYERS; l++)
     rhs[l] -= a[l]*rhs[l-1]/b[l-1];
-  }
-  //fprintf(stderr,"\n");
-  a[nl-1] = rhs[nl-1]/b[nl-1];
-  s[0,0,nl-1] = a[nl-1];
-  for (int l = nl - 2; l >= 0; l--)
-    s[0,0,l] = a[l] = (rhs[l] - c[l]*a[l+1])/b[l];
-  
+  rhs[NLAYERS-1] = rhs[NLAYERS-1]/b[NLAYERS-1];
+  s[0,0,NLAYERS-1] = rhs[NLAYERS-1];
+  for (int l = NLAYERS - 2; l >= 0; l--)
+    s[0,0,l] = rhs[l] = (rhs[l] - c[l]*rhs[l+1])/b[l];
 }
 
+/**
+The functions below diffuse a single field with a given boundary
+closure. */
+
+void vertical_diffusion_NeumanNeuman (Point point, scalar h, scalar s, double dt, double D,
+				        double dst, double dsb)
+{
+  double a[NLAYERS], b[NLAYERS], c[NLAYERS];
+  vertical_diffusion_factor (point, h, dt, D, vd_NeumanNeuman, 0., 0., a, b, c);
+  vertical_diffusion_solve (point, h, s, dt, D, vd_NeumanNeuman, dst, 0., dsb, 0.,
+			    a, b, c);
+}
 
 void vertical_diffusion_NeumanNavier (Point point, scalar h, scalar s, double dt, double D,
 				        double dst, double s_b, double lambda_b)
 {
-  double a[nl], b[nl], c[nl], rhs[nl];
+  double a[NLAYERS], b[NLAYERS], c[NLAYERS];
+  vertical_diffusion_factor (point, h, dt, D, vd_NeumanNavier, 0., lambda_b, a, b, c);
+  vertical_diffusion_solve (point, h, s, dt, D, vd_NeumanNavier, dst, 0., s_b, lambda_b,
+			    a, b, c);
+}
 
-  /**
-  The *rhs* of the tridiagonal system is $h_l s_l$. */
-      
-  foreach_layer()
-    rhs[_layer] = s[]*h[];
+void vertical_diffusion_NavierNavier (Point point, scalar h, scalar s, double dt, double D,
+				        double s_t, double lambda_t, double s_b, double lambda_b)
+{
+  double a[NLAYERS], b[NLAYERS], c[NLAYERS];
+  vertical_diffusion_factor (point, h, dt, D, vd_NavierNavier, lambda_t, lambda_b, a, b, c);
+  vertical_diffusion_solve (point, h, s, dt, D, vd_NavierNavier, s_t, lambda_t, s_b, lambda_b,
+			    a, b, c);
+}
 
-  /**
-  The lower, principal and upper diagonals $a$, $b$ and $c$ are given by
-  $$
-  a_{l > 0} = - \left( \frac{D \Delta t}{h_{l - 1 / 2}} \right)^{n + 1}
-  $$
-  $$
-  c_{l < \mathrm{nl} - 1} = - \left( \frac{D \Delta t}{h_{l + 1 / 2}}
-  \right)^{n + 1}
-  $$
-  $$
-  b_{0 < l < \mathrm{nl} - 1} = h_l^{n + 1} - a_l - c_l
-  $$
-  */
+/**
+## Diffusion of several fields
 
-  for (int l = 1; l < nl - 1; l++) {
-    a[l] = - 2.*D*dt/(h[0,0,l-1] + h[0,0,l]);
-    c[l] = - 2.*D*dt/(h[0,0,l] + h[0,0,l+1]);
-    b[l] = h[0,0,l] - a[l] - c[l];
-  }
-    
-  /**
-  For the top layer the boundary conditions give the (ghost)
-  boundary value
-  $$
-  s_{\mathrm{nl}} = s_{\mathrm{nl} - 1} + \dot{s}_t h_{\mathrm{nl} - 1},
-  $$
-  which gives the diagonal coefficient and right-hand-side
-  $$
-  b_{\mathrm{nl} - 1} = h_{\mathrm{nl} - 1}^{n + 1}
-  - a_{\mathrm{nl} - 1}
-  $$
-  $$
-  \mathrm{rhs}_{\mathrm{nl} - 1} = 
-  (hs)_{\mathrm{nl} - 1}^{\star} + D \Delta t \dot{s}_t
-  $$
-  */
+A list of fields diffused together is described by an array of
+*VDiffusion* structures, terminated by a field with a negative
+index. The boundary closure is chosen for each field, along with the
+fields giving the top and bottom boundary values (i.e. $\dot{s}_t$ or
+$s_t$, $\dot{s}_b$ or $s_b$) and slip lengths. */
 
-  a[nl-1] = - 2.*D*dt/(h[0,0,nl-2] + h[0,0,nl-1]);
-  b[nl-1] = h[0,0,nl-1] - a[nl-1];
-  rhs[nl-1] += D*dt*dst;
-  //fprintf(stderr,"%g\n",lambda_b);
+typedef struct {
+  scalar s;            // the diffused field
+  int bc;              // the boundary closure
+  scalar st, lambda_t; // top boundary value and slip length
+  scalar sb, lambda_b; // bottom boundary value and slip length
+} VDiffusion;
 
-  /**
-  For the bottom layer a third-order discretisation of the Navier slip
-  condition gives
-  $$
-  \begin{aligned}
-  b_0 & = h_0 + 2 \Delta t D \left( \frac{1}{h_0 + h_1} + \frac{h^2_1 + 3
-  h_0 h_1 + 3 h^2_0}{\det} \right),\\
-  c_0 & = - 2 \Delta t D \left( \frac{1}{h_0 + h_1} + \frac{h^2_0}{\det}
-  \right),\\
-  \text{rhs}_0 & = (hs_0)^{\star} + 2 \Delta t D s_b  \frac{h^2_1 + 3 h_0
-  h_1 + 2 h^2_0}{\det},\\
-  \det & = h_0 (h_0 + h_1)^2  + 2\lambda (3\,h_0 h_1 + 2\,h_0^2 + h_1^2),
-  \end{aligned}
-  $$
-  */
+/**
+The factorisation is re-used for consecutive fields which share the
+same matrix i.e. the same closure and the same slip lengths (which
+only matter for Navier conditions).
 
-  double den = h[]*sq(h[] + h[0,0,1]) 
-    + 2.*lambda_b*(3.*h[]*h[0,0,1] + 2.*sq(h[]) + sq(h[0,0,1]));
-  b[0] = h[] + 2.*dt*D*(1./(h[] + h[0,0,1]) +
-			  (sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 3.*sq(h[]))/den);
-  c[0] = - 2.*dt*D*(1./(h[] + h[0,0,1]) + sq(h[])/den);
-  rhs[0] += 2.*dt*D*s_b*(sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 2.*sq(h[0]))/den;
-  
+For a single layer with Neumann conditions on both boundaries (as used
+for the velocity components), the system reduces to the scalar
+equation
+$$
+h s^{n+1} = (hs)^\star + D \Delta t (\dot{s}_t - \dot{s}_b)
+$$
+which is solved directly, without assembling the matrix. This is the
+same solution as that of the tridiagonal system (up to round-off). */
 
-  if (nl == 1) {
-    b[0] += c[0];
-    rhs[0] += (- c[0]*h[] - D*dt) * dst;
-  }
-    
-  /**
-  We can now solve the tridiagonal system using the [Thomas
-  algorithm](https://en.wikipedia.org/wiki/Tridiagonal_matrix_algorithm). */
-  
-  for (int l = 1; l < nl; l++) {
-    b[l] -= a[l]*c[l-1]/b[l-1];
-    rhs[l] -= a[l]*rhs[l-1]/b[l-1];
+void vertical_diffusion_list (Point point, scalar h, VDiffusion * list,
+			      double dt, double D)
+{
+  double a[NLAYERS], b[NLAYERS], c[NLAYERS];
+  int bc = -1;
+  double lt = 0., lb = 0.;
+  for (VDiffusion * v = list; v->s.i >= 0; v++) {
+    scalar s = v->s, st = v->st, sb = v->sb;
+    if (NLAYERS == 1 && v->bc == vd_NeumanNeuman) {
+      s[] += D*dt*(st[] - sb[])/h[];
+      continue;
+    }
+    scalar lambda_t = v->lambda_t, lambda_b = v->lambda_b;
+    double vlt = lambda_t[], vlb = lambda_b[];
+    if (v->bc != bc ||
+	(v->bc != vd_NeumanNeuman && vlb != lb) ||
+	(v->bc == vd_NavierNavier && vlt != lt)) {
+      bc = v->bc, lt = vlt, lb = vlb;
+      vertical_diffusion_factor (point, h, dt, D, bc, lt, lb, a, b, c);
+    }
+    vertical_diffusion_solve (point, h, s, dt, D, bc, st[], lt, sb[], lb,
+			      a, b, c);
   }
-  a[nl-1] = rhs[nl-1]/b[nl-1];
-  s[0,0,nl-1] = a[nl-1];
-  for (int l = nl - 2; l >= 0; l--)
-    s[0,0,l] = a[l] = (rhs[l] - c[l]*a[l+1])/b[l];
 }
 
+/**
+Other modules (for example the [non-hydrostatic extension](nh.h) for
+the vertical velocity) can add fields to the list of fields diffused
+together with the horizontal velocity by the [viscous
+term](#viscous-friction-between-layers) below. At most *VD_NMAX* fields
+can be added. */
 
-void vertical_diffusion_NavierNavier (Point point, scalar h, scalar s, double dt, double D,
-				        double s_t, double lambda_t, double s_b, double lambda_b)
+#ifndef VD_NMAX
+# define VD_NMAX 8
+#endif
+
+VDiffusion * vdiffusion = NULL;
+
+void vertical_diffusion_add (VDiffusion v)
 {
-  double a[nl], b[nl], c[nl], rhs[nl];
+  int n = 0;
+  if (vdiffusion)
+    while (vdiffusion[n].s.i >= 0)
+      n++;
+  if (n >= VD_NMAX) {
+    fprintf (stderr, "vertical_diffusion_add(): error: too many fields "
+	     "(increase VD_NMAX)\n");
+    exit (1);
+  }
+  vdiffusion = qrealloc (vdiffusion, n + 2, VDiffusion);
+  vdiffusion[n] = v;
+  vdiffusion[n + 1].s.i = -1;
+}
 
-  /**
-  The *rhs* of the tridiagonal system is $h_l s_l$. */
-      
-  foreach_layer()
-    rhs[_layer] = s[]*h[];
 
-  /**
-  The lower, principal and upper diagonals $a$, $b$ and $c$ are given by
-  $$
-  a_{l > 0} = - \left( \frac{D \Delta t}{h_{l - 1 / 2}} \right)^{n + 1}
-  $$
-  $$
-  c_{l < \mathrm{nl} - 1} = - \left( \frac{D \Delta t}{h_{l + 1 / 2}}
-  \right)^{n + 1}
-  $$
-  $$
-  b_{0 < l < \mathrm{nl} - 1} = h_l^{n + 1} - a_l - c_l
-  $$
-  */
+/**
+## Batched solver
+
+The Thomas algorithm is a serial recurrence along each column, which
+cannot be vectorised. The batched solver below instead gathers
+*VD_BATCH* columns in a structure-of-arrays buffer (entry $l$ of
+column $k$ is stored at index `l*VD_BATCH + k`), so that the
+elimination and the back substitution are done in lockstep across the
+columns of the batch and can be vectorised by the compiler. The
+default batch width is the number of doubles in a SIMD register. */
+
+#ifndef VD_BATCH
+# if defined(__AVX512F__)
+#  define VD_BATCH 8
+# elif defined(__AVX__)
+#  define VD_BATCH 4
+# else
+#  define VD_BATCH 2
+# endif
+#endif
 
-  for (int l = 1; l < nl - 1; l++) {
-    a[l] = - 2.*D*dt/(h[0,0,l-1] + h[0,0,l]);
-    c[l] = - 2.*D*dt/(h[0,0,l] + h[0,0,l+1]);
-    b[l] = h[0,0,l] - a[l] - c[l];
+/**
+The batched solver is used by the viscous term when *vertical_batch*
+is set. It uses the same closures as the single-column solver and
+gives the same results (provided the contraction of floating-point
+operations is the same for both, e.g. with `-ffp-contract=off`). It
+stores the positions of the columns until the batch is full, which
+requires a grid which is not modified during the loop (i.e. not the
+GPU grids). */
+
+bool vertical_batch = false;
+
+typedef struct {
+  int n;                // number of columns in the batch
+  Point p[VD_BATCH];    // the columns
+  double * h;           // layer thicknesses
+  double * a, * b, * c; // diagonals
+  double * s;           // right-hand-sides and solutions for each field
+  double * v;           // boundary values and slip lengths for each field
+} VDBatch;
+
+static int vd_list_len (VDiffusion * list)
+{
+  int nf = 0;
+  for (VDiffusion * d = list; d->s.i >= 0; d++)
+    nf++;
+  return nf;
+}
+
+/**
+One batch is allocated for each thread. */
+
+static VDBatch * vd_batch_new (int nf)
+{
+  int nt = layered_nthreads(), W = VD_BATCH;
+  VDBatch * q = qcalloc (nt, VDBatch);
+  for (int i = 0; i < nt; i++) {
+    q[i].h = qmalloc ((4 + nf)*NLAYERS*W + 4*nf*W, double);
+    q[i].a = q[i].h + NLAYERS*W;
+    q[i].b = q[i].a + NLAYERS*W;
+    q[i].c = q[i].b + NLAYERS*W;
+    q[i].s = q[i].c + NLAYERS*W;
+    q[i].v = q[i].s + nf*NLAYERS*W;
   }
-    
-  /**
-  For the top layer the boundary conditions give the (ghost)
-  boundary value
-  $$
-  s_{\mathrm{nl}} = s_{\mathrm{nl} - 1} + \dot{s}_t h_{\mathrm{nl} - 1},
-  $$
-  which gives the diagonal coefficient and right-hand-side
-  $$
-  b_{\mathrm{nl} - 1} = h_{\mathrm{nl} - 1}^{n + 1}
-  - a_{\mathrm{nl} - 1}
-  $$
-  $$
-  \mathrm{rhs}_{\mathrm{nl} - 1} = 
-  (hs)_{\mathrm{nl} - 1}^{\star} + D \Delta t \dot{s}_t
-  $$
-  */
+  return q;
+}
 
-  double den_t = h[0,0,nl-1]*sq(h[] + h[0,0,nl-2]) 
-    + 2.*lambda_t*(3.*h[0,0,nl-1]*h[0,0,nl-2] + 2.*sq(h[0,0,nl-1]) + sq(h[0,0,nl-2]));
+static void vd_batch_free (VDBatch * q)
+{
+  for (int i = 0; i < layered_nthreads(); i++)
+    free (q[i].h);
+  free (q);
+}
 
-  a[nl-1] = + 2.*dt*D*(1./(h[0,0,nl-1] + h[0,0,nl-2]) + sq(h[0,0,nl-1])/den_t);
-  b[nl-1] = h[] - 2.*dt*D*(1./(h[0,0,nl-1] + h[0,0,nl-2]) +
-			  (sq(h[0,0,nl-2]) + 3.*h[0,0,nl-1]*h[0,0,nl-2] + 3.*sq(h[0,0,nl-1]))/den_t);
-  rhs[nl-1] -= 2.*dt*D*s_t*(sq(h[0,0,nl-2]) + 3.*h[0,0,nl-1]*h[0,0,nl-2] + 2.*sq(h[0,0,nl-1]))/den_t;
+/**
+The function below solves the systems for all the columns of the batch
+and scatters the results back into the fields. */
 
-  //fprintf(stderr,"%g\n",lambda_b);
+static void vd_batch_flush (VDiffusion * list, VDBatch * q, double dt, double D)
+{
+  const int W = VD_BATCH;
+  int n = q->n, nf = vd_list_len (list);
+  if (n == 0)
+    return;
 
   /**
-  For the bottom layer a third-order discretisation of the Navier slip
-  condition gives
-  $$
-  \begin{aligned}
-  b_0 & = h_0 + 2 \Delta t D \left( \frac{1}{h_0 + h_1} + \frac{h^2_1 + 3
-  h_0 h_1 + 3 h^2_0}{\det} \right),\\
-  c_0 & = - 2 \Delta t D \left( \frac{1}{h_0 + h_1} + \frac{h^2_0}{\det}
-  \right),\\
-  \text{rhs}_0 & = (hs_0)^{\star} + 2 \Delta t D s_b  \frac{h^2_1 + 3 h_0
-  h_1 + 2 h^2_0}{\det},\\
-  \det & = h_0 (h_0 + h_1)^2  + 2\lambda (3\,h_0 h_1 + 2\,h_0^2 + h_1^2),
-  \end{aligned}
-  $$
-  */
-
-  double den = h[]*sq(h[] + h[0,0,1]) 
-    + 2.*lambda_b*(3.*h[]*h[0,0,1] + 2.*sq(h[]) + sq(h[0,0,1]));
-  b[0] = h[] + 2.*dt*D*(1./(h[] + h[0,0,1]) +
-			  (sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 3.*sq(h[]))/den);
-  c[0] = - 2.*dt*D*(1./(h[] + h[0,0,1]) + sq(h[])/den);
-  rhs[0] += 2.*dt*D*s_b*(sq(h[0,0,1]) + 3.*h[]*h[0,0,1] + 2.*sq(h[0]))/den;
+  The unused columns of an incomplete batch are copies of the first
+  column. */
   
-  /**
-  if (nl == 1) {
-    b[0] += c[0];
-    rhs[0] += (- c[0]*h[] - D*dt) * dst;
+  for (int k = n; k < W; k++) {
+    for (int l = 0; l < NLAYERS; l++)
+      q->h[l*W + k] = q->h[l*W];
+    for (int j = 0; j < nf*NLAYERS; j++)
+      q->s[j*W + k] = q->s[j*W];
+    for (int j = 0; j < 4*nf; j++)
+      q->v[j*W + k] = q->v[j*W];
   }
-  */
+
+  double * a = q->a, * b = q->b, * c = q->c, lt[VD_BATCH], lb[VD_BATCH];
+  int bc = -1, f = 0;
+  for (VDiffusion * d = list; d->s.i >= 0; d++, f++) {
+    double * v = q->v + 4*f*W, * r = q->s + f*NLAYERS*W;
+
+    /**
+    As for the single-column solver, the matrices are re-used if
+    possible. */
     
-  /**
-  We can now solve the tridiagonal system using the [Thomas
-  algorithm](https://en.wikipedia.org/wiki/Tridiagonal_matrix_algorithm). */
-  
-  for (int l = 1; l < nl; l++) {
-    b[l] -= a[l]*c[l-1]/b[l-1];
-    rhs[l] -= a[l]*rhs[l-1]/b[l-1];
+    bool factor = (d->bc != bc);
+    for (int k = 0; k < W && !factor; k++)
+      factor = ((d->bc != vd_NeumanNeuman && v[3*W + k] != lb[k]) ||
+		(d->bc == vd_NavierNavier && v[W + k] != lt[k]));
+    if (factor) {
+      bc = d->bc;
+      for (int k = 0; k < W; k++) {
+	lt[k] = v[W + k], lb[k] = v[3*W + k];
+	vd_matrix (q->h + k, W, dt, D, bc, lt[k], lb[k], a + k, b + k, c + k);
+      }
+      for (int l = 1; l < NLAYERS; l++)
+	for (int k = 0; k < W; k++)
+	  b[l*W + k] -= a[l*W + k]*c[(l-1)*W + k]/b[(l-1)*W + k];
+    }
+    for (int k = 0; k < W; k++)
+      vd_rhs (q->h + k, W, dt, D, bc, v[k], lt[k], v[2*W + k], lb[k],
+	      c + k, r + k);
+    for (int l = 1; l < NLAYERS; l++)
+      for (int k = 0; k < W; k++)
+	r[l*W + k] -= a[l*W + k]*r[(l-1)*W + k]/b[(l-1)*W + k];
+    for (int k = 0; k < W; k++)
+      r[(NLAYERS-1)*W + k] = r[(NLAYERS-1)*W + k]/b[(NLAYERS-1)*W + k];
+    for (int l = NLAYERS - 2; l >= 0; l--)
+      for (int k = 0; k < W; k++)
+	r[l*W + k] = (r[l*W + k] - c[l*W + k]*r[(l+1)*W + k])/b[l*W + k];
   }
-  a[nl-1] = rhs[nl-1]/b[nl-1];
-  s[0,0,nl-1] = a[nl-1];
-  for (int l = nl - 2; l >= 0; l--)
-    s[0,0,l] = a[l] = (rhs[l] - c[l]*a[l+1])/b[l];
+
+  for (int k = 0; k < n; k++) {
+    Point point = q->p[k];
+    f = 0;
+    for (VDiffusion * d = list; d->s.i >= 0; d++, f++) {
+      scalar s = d->s;
+      for (int l = 0; l < NLAYERS; l++)
+	s[0,0,l] = q->s[(f*NLAYERS + l)*W + k];
+    }
+  }
+  q->n = 0;
 }
 
+/**
+This function is called for each column within a *foreach()* loop. It
+gathers the column in the batch *q* of the current thread and solves
+the batch once it is full. */
+
+static void vd_batch_push (Point point, scalar h, VDiffusion * list,
+			   VDBatch * q, double dt, double D)
+{
+  const int W = VD_BATCH;
+  int k = q->n, f = 0;
+  q->p[k] = point;
+  foreach_layer()
+    q->h[_layer*W + k] = h[];
+  for (VDiffusion * d = list; d->s.i >= 0; d++, f++) {
+    scalar s = d->s, st = d->st, sb = d->sb;
+    scalar lambda_t = d->lambda_t, lambda_b = d->lambda_b;
+    foreach_layer()
+      q->s[(f*NLAYERS + _layer)*W + k] = s[]*h[];
+    double * v = q->v + 4*f*W + k;
+    v[0] = st[], v[W] = lambda_t[], v[2*W] = sb[], v[3*W] = lambda_b[];
+  }
+  if (++q->n == W)
+    vd_batch_flush (list, q, dt, D);
+}
+
+/**
+The function below solves the remaining incomplete batches, once the
+loop is done, and frees the batches. The fields modified outside of
+the loop need their boundary conditions to be updated. */
+
+static void vd_batch_finish (VDiffusion * list, VDBatch * q, double dt, double D)
+{
+  for (int i = 0; i < layered_nthreads(); i++)
+    vd_batch_flush (list, q + i, dt, D);
+  vd_batch_free (q);
+  for (VDiffusion * d = list; d->s.i >= 0; d++) {
+    scalar s = d->s;
+    s.dirty = true;
+  }
+}
 
 
 /**
@@ -348,114 +546,189 @@ $$
 with $D$ the diffusion coefficient. Note that metric terms linked to
 the slope of the layers are not taken into account. Note also that the
 time discretisation is explicit so that the timestep must be limited
-(manually) by $\min(\Delta^2/D)$. */
-
-
-void horizontal_diffusion_Neumann (scalar s, double D, double dt, scalar dst)
+(manually) by $\min(\Delta^2/D)$, unless
+[super-time-stepping](#super-time-stepping) is used.
+
+The increments of $s$ are computed by the functions below in a single
+pass over the grid: each column is visited once and the layer
+interface heights $z_l$ (in the column and its neighbours) are
+integrated on the fly. Since the stencil reads the (old) values of $s$
+in the neighbouring columns, the increments cannot be added to $s$
+within the same loop. They are stored in *ds*, which is added to $s$
+by the caller, in a loop which is needed anyway (e.g. the last loop of
+the [viscous term](#viscous-friction-between-layers) or the update of
+the [super-time-stepping](#super-time-stepping) stages), so that the
+grid is only traversed once per diffusion.
+
+The increment of layer $l$ is the sum of the horizontal Laplacian of
+$s_l$ and of terms which couple $s_l$ with the layers above and below,
+through the horizontal gradients of the layer thicknesses and of the
+interface heights $z_l$. For the top layer, the value above is given
+by the top boundary condition (the surface gradient *dst* or the
+surface value *st*). */
+
+static void hdiffusion_Neumann (scalar s, double D, double dt, scalar dst,
+				scalar ds)
 {
-  if (D > 0.) {
-    scalar d2s[];
-    foreach_layer() {
-      foreach() {
-	double a = 0.;
-	foreach_dimension(){
-	  a += (s[-1] -2.*s[] + s[1]);
-	}
-	d2s[] = a/(sq(Delta));
-      }
-    }
-  
-    
-    scalar zl[];
-    foreach()
-      zl[]=zb[];
-    scalar d2sz[];
+  foreach() {
+    double zl = zb[];
+    coord zlp, zlm;
+    foreach_dimension()
+      zlp.x = zb[1], zlm.x = zb[-1];
     for (int l = 0; l < nl; l++) {
-      foreach(){
-	double b = 0;
-	foreach_dimension(){
-	  if (l<nl-1){
-	    b += (s[1,0,l]-s[-1,0,l]-s[1,0,l+1]+s[-1,0,l+1])*(h[1,0,l]-h[-1,0,l])/4.;
-	    b += (s[0,0,l]-s[0,0,l+1])*(h[1,0,l]-2.*h[0,0,l]+h[-1,0,l])/2.;
-	    if(l>0){
-	      b -= (s[1,0,l+1]-s[-1,0,l+1]-s[1,0,l-1]+s[-1,0,l-1])*(zl[1,0]-zl[-1,0])/4.;
-	      b -= (s[0,0,l+1]-s[0,0,l-1])*(zl[1,0]-2.*zl[0,0]+zl[-1,0])/2.;
-	    }
+      double a = 0., b = 0.;
+      foreach_dimension() {
+	a += s[-1,0,l] - 2.*s[0,0,l] + s[1,0,l];
+	if (l < nl - 1) {
+	  b += (s[1,0,l]-s[-1,0,l]-s[1,0,l+1]+s[-1,0,l+1])*(h[1,0,l]-h[-1,0,l])/4.;
+	  b += (s[0,0,l]-s[0,0,l+1])*(h[1,0,l]-2.*h[0,0,l]+h[-1,0,l])/2.;
+	  if (l > 0) {
+	    b -= (s[1,0,l+1]-s[-1,0,l+1]-s[1,0,l-1]+s[-1,0,l-1])*(zlp.x-zlm.x)/4.;
+	    b -= (s[0,0,l+1]-s[0,0,l-1])*(zlp.x-2.*zl+zlm.x)/2.;
 	  }
-	  else{
-	    b += (-dst[1,0]*h[1,0,l]+dst[-1,0]*h[-1,0,l])*(h[1,0,l]-h[-1,0,l])/4.;
-	    b += (-dst[]*h[0,0,l])*(h[1,0,l]-2.*h[0,0,l]+h[-1,0,l])/2.;
-	    if(l>0){
-	      b -= (s[1,0,l]+dst[1,0]*h[1,0,l]-s[-1,0,l]-dst[-1,0]*h[-1,0,l]-s[1,0,l-1]+s[-1,0,l-1])*(zl[1,0]-zl[-1,0])/4.;
-	      b -= (s[0,0,l]+dst[1,0]*h[1,0,l]-s[0,0,l-1])*(zl[1,0]-2.*zl[0,0]+zl[-1,0])/2.;
-	    }
+	}
+	else {
+	  b += (-dst[1,0]*h[1,0,l]+dst[-1,0]*h[-1,0,l])*(h[1,0,l]-h[-1,0,l])/4.;
+	  b += (-dst[]*h[0,0,l])*(h[1,0,l]-2.*h[0,0,l]+h[-1,0,l])/2.;
+	  if (l > 0) {
+	    b -= (s[1,0,l]+dst[1,0]*h[1,0,l]-s[-1,0,l]-dst[-1,0]*h[-1,0,l]-s[1,0,l-1]+s[-1,0,l-1])*(zlp.x-zlm.x)/4.;
+	    b -= (s[0,0,l]+dst[1,0]*h[1,0,l]-s[0,0,l-1])*(zlp.x-2.*zl+zlm.x)/2.;
 	  }
 	}
-	d2sz[0,0,l]= b/sq(Delta);
       }
-      foreach()
-	zl[]+=h[0,0,l];
-    } 
-    foreach_layer() 
-      foreach()
-	if (h[] > dry) 
-	    s[] += dt*D*d2s[];
-    for (int l = 0; l < nl; l++) 
-      foreach()
-	if (h[0,0,l] > dry)
-	  s[0,0,l] += dt*D*d2sz[0,0,l]/h[0,0,l];
+      ds[0,0,l] = h[0,0,l] > dry ? dt*D*(a + b/h[0,0,l])/sq(Delta) : 0.;
+      zl += h[0,0,l];
+      foreach_dimension()
+	zlp.x += h[1,0,l], zlm.x += h[-1,0,l];
+    }
   }
 }
 
-void horizontal_diffusion_Navier (scalar s, double D, double dt, scalar st)
+static void hdiffusion_Navier (scalar s, double D, double dt, scalar st,
+			       scalar ds)
 {
-  if (D > 0.) {
-    scalar d2s[];
-    foreach_layer() {
-      foreach() {
-	double a = 0.;
-	foreach_dimension(){
-	  a += (h[-1]*s[-1] -2.*h[]*s[] + h[1]*s[1]);
-	}
-	d2s[] = a/(sq(Delta));
+  foreach() {
+    double zl = zb[];
+    coord zlp, zlm;
+    foreach_dimension()
+      zlp.x = zb[1], zlm.x = zb[-1];
+    for (int l = 0; l < nl; l++) {
+      double a = 0., b = 0.;
+      foreach_dimension() {
+	a += h[-1,0,l]*s[-1,0,l] - 2.*h[0,0,l]*s[0,0,l] + h[1,0,l]*s[1,0,l];
+	if (l > 0)
+	  b += 2.*(((s[1,0,l-1]+s[1,0,l])/2.)-((s[-1,0,l-1]+s[-1,0,l])/2.))/2.*(zlp.x-zlm.x)/2. +(s[0,0,l-1]+s[0,0,l])/2.*(zlm.x-2.*zl+zlp.x);
+	if (l < nl - 1)
+	  b -= 2.*(((s[1,0,l+1]+s[1,0,l])/2.)-((s[-1,0,l+1]+s[-1,0,l])/2.))/2.*((zlp.x+h[1,0,l])-(zlm.x+h[-1,0,l]))/2. +(s[0,0,l+1]+s[0,0,l])/2.*((zlm.x+h[-1,0,l])-2.*(zl+h[0,0,l])+(zlp.x+h[1,0,l]));
+	else
+	  b -= 2.*(st[1,0]-st[-1,0])/2.*((zlp.x+h[1,0,l])-(zlm.x+h[-1,0,l]))/2. +st[]*((zlm.x+h[-1,0,l])-2.*(zl+h[0,0,l])+(zlp.x+h[1,0,l]));
       }
+      ds[0,0,l] = h[0,0,l] > dry ? dt*D*(a + b)/(sq(Delta)*h[0,0,l]) : 0.;
+      zl += h[0,0,l];
+      foreach_dimension()
+	zlp.x += h[1,0,l], zlm.x += h[-1,0,l];
     }
+  }
+}
+
+typedef void (* HDiffusion) (scalar s, double D, double dt, scalar bc,
+			     scalar ds);
+
+/**
+The functions below update $s$ directly (using a temporary field for
+the increments). */
+
+static void hdiffusion_apply (HDiffusion diffusion,
+			      scalar s, double D, double dt, scalar bc)
+{
+  scalar ds = pool_scalar (nl);
+  diffusion (s, D, dt, bc, ds);
+  foreach()
+    foreach_layer()
+      s[] += ds[];
+  pool_release ({ds});
+}
+
+void horizontal_diffusion_Neumann (scalar s, double D, double dt, scalar dst)
+{
+  if (D > 0.)
+    hdiffusion_apply (hdiffusion_Neumann, s, D, dt, dst);
+}
+
+void horizontal_diffusion_Navier (scalar s, double D, double dt, scalar st)
+{
+  if (D > 0.)
+    hdiffusion_apply (hdiffusion_Navier, s, D, dt, st);
+}
+
+/**
+## Super-time-stepping
+
+The explicit horizontal diffusion functions above are stable only for
+$\Delta t \leq \Delta t_e = \Delta^2/(2dD)$, with $d$ the number of
+dimensions. When *h_sts* is set, they are instead combined using the
+first-order Runge--Kutta--Legendre super-time-stepping scheme (Meyer,
+Balsara & Aslam, 2012) which, for $m$ stages, is stable for
+$$
+\Delta t \leq \Delta t_e\frac{m^2 + m}{2}
+$$
+The number of stages is chosen automatically using this condition and
+is stored in *h_stages*. Each stage is a call to the explicit function
+(as a black box), with a timestep $\tilde{\mu}_j\Delta t$ and
+$$
+Y_j = \mu_j Y_{j-1} + \nu_j Y_{j-2} + \tilde{\mu}_j \Delta t\mathcal{L}(Y_{j-1})
+$$
+with $\mu_j = (2j - 1)/j$, $\nu_j = (1 - j)/j$ and
+$\tilde{\mu}_j = 2\mu_j/(m^2 + m)$. Each stage requires two passes over
+the grid: the computation of the increment and the update of $Y_j$
+(and of $Y_{j-1}$, stored in a temporary field).
+
+The function below stores the increment in *ds* (which must then be
+added to $s$ by the caller) if super-time-stepping is not needed, in
+which case it returns *true*. Otherwise, $s$ is updated directly. */
 
+bool h_sts = false;
+int h_stages = 1;
 
-    scalar zl[];
+bool horizontal_diffusion_step (HDiffusion diffusion,
+				scalar s, double D, double dt, scalar bc,
+				scalar ds)
+{
+  if (D <= 0.)
+    return false;
+  int m = 1;
+  if (h_sts) {
+    double dte = HUGE;
+    foreach (reduction(min:dte)) {
+      double d = sq(Delta*cm[])/(2.*dimension*D);
+      if (d < dte)
+	dte = d;
+    }
+    m = max (ceil ((sqrt (1. + 8.*dt/dte) - 1.)/2.), 1);
+    h_stages = m;
+  }
+  if (m == 1) {
+    diffusion (s, D, dt, bc, ds);
+    return true;
+  }
+  scalar y1 = pool_scalar (nl);
+  double w = 2./(sq(m) + m);
+  for (int j = 1; j <= m; j++) {
+    double mu = (2.*j - 1.)/j, nuj = (1. - j)/j;
+    diffusion (s, D, mu*w*dt, bc, ds);
     foreach()
-      zl[]=zb[];
-    scalar d2sz[];
-    for (int l = 0; l < nl; l++) {
-      foreach(){
-	double b = 0;
-	foreach_dimension(){
-	  if (l > 0){
-	    b += 2.*(((s[1,0,l-1]+s[1,0,l])/2.)-((s[-1,0,l-1]+s[-1,0,l])/2.))/2.*(zl[1]-zl[-1])/2. +(s[0,0,l-1]+s[0,0,l])/2.*(zl[-1]-2.*zl[]+zl[1]);
-	  }
-	  if (l < nl-1){
-	    b -= 2.*(((s[1,0,l+1]+s[1,0,l])/2.)-((s[-1,0,l+1]+s[-1,0,l])/2.))/2.*((zl[1]+h[1,0,l])-(zl[-1]+h[-1,0,l]))/2. +(s[0,0,l+1]+s[0,0,l])/2.*((zl[-1]+h[-1,0,l])-2.*(zl[0]+h[0,0,l])+(zl[1]+h[1,0,l]));
-	  }
-	  else
-	    b -= 2.*(st[1,0]-st[-1,0])/2.*((zl[1]+h[1,0,l])-(zl[-1]+h[-1,0,l]))/2. +st[]*((zl[-1]+h[-1,0,l])-2.*(zl[0]+h[0,0,l])+(zl[1]+h[1,0,l]));
-	}
-	d2sz[0,0,l]= b/sq(Delta);
+      foreach_layer() {
+	double y = s[];
+	s[] = mu*y + ds[];
+	if (j > 1)
+	  s[] += nuj*y1[];
+	y1[] = y;
       }
-      foreach()
-	zl[]+=h[0,0,l];
-    } 
-    foreach_layer() 
-      foreach()
-	if (h[] > dry) 
-	    s[] += dt*D*d2s[]/h[];
-    for (int l = 0; l < nl; l++) 
-      foreach()
-	if (h[0,0,l] > dry)
-	  s[0,0,l] += dt*D*d2sz[0,0,l]/h[0,0,l];
   }
+  pool_release ({y1});
+  return false;
 }
 
-
 /**
 void horizontal_diffusion (scalar * list, double D, double dt)
 {
@@ -541,30 +814,106 @@ event viscous_term (i++,last)
 {
   if (nu > 0.) {    
 
+    /**
+    The components of velocity are diffused together with the fields
+    added by other modules, using a single factorisation of the
+    (Neumann--Neumann) matrix for all the components. */
+
+    int n = 0;
+    for (VDiffusion * v = vdiffusion; v && v->s.i >= 0; v++)
+      n++;
+    VDiffusion list[dimension + VD_NMAX + 1];
+    int k = 0;
+    foreach_dimension()
+      list[k++] = (VDiffusion){u.x, vd_NeumanNeuman, dut.x, zeroc, dub.x, zeroc};
+    //list[k++] = (VDiffusion){u.x, vd_NeumanNavier, dut.x, zeroc, u_b.x, dub.x};
+    for (int j = 0; j < n; j++)
+      list[k++] = vdiffusion[j];
+    list[k].s.i = -1;
+    
+    profile_start (PROF_VERTICAL_DIFFUSION);
+#if _GPU
+    VDBatch * q = NULL;
+#else
+    VDBatch * q = vertical_batch && NLAYERS > 1 ? vd_batch_new (k) : NULL;
+#endif
     foreach() {
       foreach_layer()
 	foreach_dimension()
 	  u.x[] += dt*(ha.x[] + ha.x[1])/(hf.x[] + hf.x[1] + dry);
-      foreach_dimension()
-	vertical_diffusion_NeumanNeuman (point, h, u.x, dt, nu,
-					 dut.x[], dub.x[]);
-      //vertical_diffusion_NeumanNavier (point, h, u.x, dt, nu,
-      //				 dut.x[], u_b.x[], dub.x[]);
+      if (wet_column()) {
+	if (q)
+	  vd_batch_push (point, h, list, q + layered_tid(), dt, nu);
+	else
+	  vertical_diffusion_list (point, h, list, dt, nu);
+      }
     }
-    if (h_diffusion){
-      vector dup[];
-      foreach()
-	foreach_dimension()
-	dup.x[]=dut.x[];
+    if (q)
+      vd_batch_finish (list, q, dt, nu);
+    profile_stop (PROF_VERTICAL_DIFFUSION);
+
+    /**
+    The increments of the horizontal diffusion are added (to the
+    velocity and to the other fields) in the last loop below, together
+    with the removal of the acceleration, unless super-time-stepping
+    is used (in which case the fields are updated directly and the
+    increments are set to zero). */
+    
+    vector du;
+    scalar * sl = NULL, * dsl = NULL;
+    if (h_diffusion) {
+      profile_start (PROF_HORIZONTAL_DIFFUSION);
+      du = pool_vector (nl);
+      bool apply = false;
       foreach_dimension()
-      	horizontal_diffusion_Neumann (u.x, nu, dt, dup.x);
+      	apply = horizontal_diffusion_step (hdiffusion_Neumann,
+					   u.x, nu, dt, dut.x, du.x);
+      if (!apply)
+	reset ((scalar *){du}, 0.);
+
+      /**
+      The horizontal diffusion of the other fields uses the variant
+      consistent with their top boundary condition. */
+      
+      for (VDiffusion * v = vdiffusion; v && v->s.i >= 0; v++) {
+	scalar ds = pool_scalar (nl);
+	if (horizontal_diffusion_step (v->bc == vd_NavierNavier ?
+				       hdiffusion_Navier :
+				       hdiffusion_Neumann,
+				       v->s, nu, dt, v->st, ds))
+	  sl = list_append (sl, v->s), dsl = list_append (dsl, ds);
+	else
+	  pool_release ({ds});
+      }
+      profile_stop (PROF_HORIZONTAL_DIFFUSION);
     }
-    foreach() {
-      foreach_layer()
-	foreach_dimension()
-	  u.x[] -= dt*(ha.x[] + ha.x[1])/(hf.x[] + hf.x[1] + dry);
+    if (h_diffusion) {
+      foreach() {
+	foreach_layer() {
+	  foreach_dimension()
+	    u.x[] = u.x[] + du.x[] - dt*(ha.x[] + ha.x[1])/(hf.x[] + hf.x[1] + dry);
+	  scalar s, ds;
+	  for (s, ds in sl, dsl)
+	    s[] += ds[];
+	}
+      }
+      pool_release ((scalar *){du});
+      pool_release (dsl);
+      free (sl), free (dsl);
     }
+    else
+      foreach() {
+	foreach_layer()
+	  foreach_dimension()
+	    u.x[] -= dt*(ha.x[] + ha.x[1])/(hf.x[] + hf.x[1] + dry);
+      }
   }
+  profile_event (PROF_VISCOUS_TERM);
+}
+
+event cleanup (t = end)
+{
+  free (vdiffusion), vdiffusion = NULL;
 }
 
 /**
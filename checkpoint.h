@@ -0,0 +1,102 @@
+/**
+# Checkpoint/restart of the multilayer solver
+
+The fields of the [multilayer solver](hydro.h) (all the layers of
+$h$, $\mathbf{u}$ and, for the [non-hydrostatic solver](nh.h), $w$
+and $\phi$, together with $\eta$, $z_b$, $\sigma$ etc.) are saved by
+the standard [dump()](/src/output.h#dump) function, which is
+parallel (each process writes its part of the file directly, at an
+offset computed collectively, without gathering the fields on the
+master process). The restart can be done on a different number of
+processes when using trees.
+
+Some of the state of the solver is not stored in fields and is saved
+in a (small) separate file, with the `.state` extension, by
+*layered_dump()*:
+
+* the estimated timestep *pdt* used by
+  [face_fields](hydro.h#face_fields), so that the first timestep
+  after restart is not reduced,
+* the times and number of the previous solutions used by the
+  [extrapolated initial guesses](implicit.h#extrapolated-initial-guess)
+  of the multigrid solvers (the solutions themselves are fields and
+  are dumped with the others).
+
+The state is restored (and the fields of the initial guesses are
+allocated) by *layered_restore()* which then restores the fields.
+This is typically used as
+~~~literatec
+event init (i = 0) {
+  if (!layered_restore ("dump")) {
+    ... initial conditions ...
+  }
+}
+~~~
+*/
+
+#ifdef IMPLICIT_H
+static void guess_write (FILE * fp, Guess * g)
+{
+  fprintf (fp, "%s %d %.17g %.17g %.17g %d\n", g->name, g->n,
+	   g->t[0], g->t[1], g->t[2], g->p[0] != NULL);
+}
+
+static void guess_read (FILE * fp, Guess * g, scalar * a)
+{
+  char name[80];
+  int allocated;
+  if (fscanf (fp, "%79s %d %lf %lf %lf %d", name, &g->n,
+	      &g->t[0], &g->t[1], &g->t[2], &allocated) != 6 ||
+      strcmp (name, g->name)) {
+    fprintf (stderr, "layered_restore(): error: could not read %s\n",
+	     g->name);
+    exit (1);
+  }
+  if (allocated && !g->p[0])
+    guess_alloc (g, a);
+}
+#endif // IMPLICIT_H
+
+void layered_dump (const char * file)
+{
+  dump (file = file);
+  if (pid() == 0) {
+    char name[strlen(file) + 7];
+    sprintf (name, "%s.state", file);
+    FILE * fp = fopen (name, "w");
+    if (!fp) {
+      perror (name);
+      exit (1);
+    }
+    fprintf (fp, "%.17g\n", pdt);
+#ifdef IMPLICIT_H
+    guess_write (fp, &mgH_guess);
+#endif
+#if NH
+    guess_write (fp, &mgp_guess);
+#endif
+    fclose (fp);
+  }
+}
+
+bool layered_restore (const char * file)
+{
+  char name[strlen(file) + 7];
+  sprintf (name, "%s.state", file);
+  FILE * fp = fopen (name, "r");
+  if (!fp)
+    return false;
+  if (fscanf (fp, "%lf", &pdt) != 1) {
+    fprintf (stderr, "layered_restore(): error: could not read '%s'\n",
+	     name);
+    exit (1);
+  }
+#ifdef IMPLICIT_H
+  guess_read (fp, &mgH_guess, {eta});
+#endif
+#if NH
+  guess_read (fp, &mgp_guess, {phi,eta});
+#endif
+  fclose (fp);
+  return restore (file = file);
+}
@@ -0,0 +1,75 @@
+/**
+# Adaptive refinement for thin films
+
+This file adds mesh adaptation to the [multilayer solver](hydro.h),
+for thin films with surface tension and/or van der Waals forces. It
+must be included after the solver headers. The mesh is adapted, at
+each timestep, using the wavelet-estimated discretisation errors of
+three fields:
+
+* the free-surface elevation $\eta$, with tolerance *film_eta_err*,
+* the curvature $\kappa\approx\nabla^2\eta$, with tolerance
+  *film_kappa_err*,
+* the logarithm of the total depth $H$, with tolerance *film_h_err*.
+
+The error on $\log H$ is the relative error on the film thickness
+i.e. it scales like $1/H$, so that the mesh is refined (up to
+*film_maxlevel*) when the film gets thin (close to rupture or to a
+contact line), even if the variations of $\eta$ are small. The depth
+is bounded below by *film_hmin*. Flat, thick regions of the film are
+coarsened down to *film_minlevel*. The [solver](hydro.h#mesh-changes)
+is notified when the mesh is modified.
+
+Consistent refinement functions are used for the solver fields:
+
+* the elevation (i.e. $z_b$ and the layer thicknesses $h$) is
+  refined conserving volume and the free-surface elevation, using
+  [conserve_layered_elevation()](hydro.h#conservation-of-water-surface-elevation),
+* the velocities $\mathbf{u}$ and $w$ (and other tracers) are refined
+  linearly, as set by the [solver](hydro.h#defaults),
+* the non-hydrostatic pressure $\phi$ and the surface tension
+  coefficient $\sigma$ (when it is not constant) are refined linearly.
+
+The auxilliary fields of the [surface tension](hydro-tension.h) and
+of the solvers ($\sigma_n$, $\sigma_d$, the restriction of $\eta$
+etc.) are recomputed at each timestep and do not need to be
+consistently refined. */
+
+#if TREE
+int film_maxlevel = 10, film_minlevel = 5;
+double film_eta_err = 1e-4, film_kappa_err = 1e-2, film_h_err = 0.05;
+double film_hmin = 1e-6;
+
+event init (i = 0)
+{
+  conserve_layered_elevation();
+#if NH
+  phi.refine = phi.prolongation = refine_linear;
+  phi.restriction = restriction_volume_average;
+#endif
+#if TENSION
+  if (!is_constant (sigma)) {
+    scalar s = sigma;
+    s.refine = s.prolongation = refine_linear;
+    s.restriction = restriction_volume_average;
+  }
+#endif
+}
+
+event adapt (i++)
+{
+  scalar kappa = pool_scalar (1), lh = pool_scalar (1);
+  foreach() {
+    double k = 0.;
+    foreach_dimension()
+      k += (eta[1] - 2.*eta[] + eta[-1])/sq(Delta);
+    kappa[] = depth[] > dry ? k : 0.;
+    lh[] = log (max (depth[], film_hmin));
+  }
+  astats s = adapt_wavelet ({eta, kappa, lh},
+			   (double[]){film_eta_err, film_kappa_err, film_h_err},
+			   film_maxlevel, film_minlevel);
+  grid_adapted = grid_adapted || s.nf + s.nc > 0;
+  pool_release ({kappa, lh});
+}
+#endif // TREE
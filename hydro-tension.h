@@ -22,6 +22,8 @@ is treated implicitly and does not restrict the timestep.
 The default surface tension coefficient $\sigma$ is constant and equal to
 unity. */
  
+#define TENSION 1
+
  (const) scalar sigma = unity ;
 double rhom = 1. [-3,0];
 
@@ -104,9 +106,57 @@ decoupling. */
 #endif // dimension == 2
 
 
-#define p_cap(eta,i) (sigma_kappa(eta, i))
-#define a_cap(eta, i)						\
+/**
+When *CAP_PRESSURE* is defined, the capillary pressure is computed once
+per timestep (in the [face_fields event](#face_fields) below) and
+stored in the *pcap* field, so that the capillary acceleration only
+requires a 2-point difference. Note that *pcap* is then only valid for
+$\eta$ at the beginning of the timestep, which is where the capillary
+acceleration is evaluated. */
+
+#if CAP_PRESSURE
+scalar pcap;
+# define p_cap(eta,i) (pcap[i])
+#else
+# define p_cap(eta,i) (sigma_kappa(eta, i))
+#endif
+
+/**
+When *CAP_IMPLICIT* is defined, the Laplace pressure is instead added
+to the barotropic pressure, so that it is treated implicitly (with the
+same $\theta_H$ weighting as the hydrostatic pressure) by the
+Poisson--Helmholtz solvers of the [implicit](implicit.h) and
+[non-hydrostatic](nh.h) schemes. Since the non-linear coefficients
+$\sigma_n$ and $\sigma_d$ are frozen at the beginning of the timestep,
+the operator remains linear in $\eta$ (a fourth-order Helmholtz
+operator). The capillary wave celerity then does not restrict the
+timestep (since *CFL_H* is set to $\infty$ by these schemes). */
+
+#if CAP_IMPLICIT
+# define a_cap(eta, i) (0)
+#else
+# define a_cap(eta, i)						\
   (gmetric(i)*(p_cap (eta, i) - p_cap (eta, i - 1))/Delta)
+#endif
+
+/**
+Other modules (for example the [van der Waals
+forces](van-der-waals.h)) can add an implicit contribution to the
+barotropic pressure by defining *p_VdW*. */
+
+#ifndef p_VdW
+# define p_VdW(eta, i) (0.)
+#endif
+
+#if CAP_IMPLICIT || VDW_IMPLICIT
+# if CAP_IMPLICIT
+#  define p_baro(eta,i) (- G*eta[i] + sigma_kappa(eta, i) + p_VdW(eta, i))
+# else
+#  define p_baro(eta,i) (- G*eta[i] + p_VdW(eta, i))
+# endif
+# define a_baro(eta, i)						\
+  (gmetric(i)*(p_baro (eta, i) - p_baro (eta, i - 1))/Delta)
+#endif
 /** 
 not a great way of doing this as it doesn't work if you have other accelerations
 */
@@ -119,6 +169,16 @@ not a great way of doing this as it doesn't work if you have other accelerations
   (gmetric(i)*(p_baro (eta, i) - p_baro (eta, i - 1))/Delta)
 */
 
+/**
+In the case of a time-explicit integration (as controlled by CFL_H),
+we need to restrict the timestep based on the celerity of capillary
+waves (and not only gravity waves as done by the default solver). This
+is done by adding the contribution of the shortest capillary waves (of
+wavelength $2\Delta$) to the celerity [computed by
+hydro.h](/src/layered/hydro.h#face_fields). */
+
+#define g_cap(i) (max(sigma[i], sigma[i-1])/rhom*sq(pi/Delta))
+
 #include "hydro.h"
 
 /**
@@ -127,10 +187,9 @@ surface elevation at the beginning of the timestep. */
 
 event face_fields (i++)
 {
-  sigma_n = new scalar;
+  sigma_n = pool_scalar (1);
 #if dimension > 1
-  scalar dx = new scalar, dy = new scalar;
-  sigma_d.x = dx, sigma_d.y = dy;
+  sigma_d.x = pool_scalar (1), sigma_d.y = pool_scalar (1);
 #endif
 
   foreach() {
@@ -143,7 +202,6 @@ event face_fields (i++)
     n = pow(n, 3./2.);
 #if dimension == 1
     sigma_n[] = sigma[]/n;
-    //fprintf(stderr,"%\n",n);
 #else
     sigma_n[] = - sigma[]*dh.x*dh.y/(2.*n);
     foreach_dimension()
@@ -151,48 +209,29 @@ event face_fields (i++)
 #endif
   }
 #if dimension == 1
-  boundary ({sigma_n});
-  restriction ({sigma_n});
+  restriction_defer ({sigma_n});
 #else
-  boundary ({sigma_n, sigma_d});
-  restriction ({sigma_n, sigma_d});
+  restriction_defer ({sigma_n, sigma_d});
 #endif  
-  
-  /**
-  In the case of a time-explicit integration (as controlled by CFL_H),
-  we need to restrict the timestep based on the celerity of capillary
-  waves (and not only gravity waves as done by the default solver). To
-  do so, we imitate the code in
-  [hydro.h](/src/layered/hydro.h#face_fields) which sets `dtmax`, but
-  take into account the celerity of the shortest capillary waves (of
-  wavelength $2\Delta$). */ 
-  foreach_face (reduction (min:dtmax)) {
-    double H = 0., um = 0.;
-    foreach_layer() {
-      double hl = h[-1] > dry ? h[-1] : 0.;
-      double hr = h[] > dry ? h[] : 0.;
-      double uf = hl > 0. || hr > 0. ? (hl*u.x[-1] + hr*u.x[])/(hl + hr) : 0.;
-      if (fabs(uf) > um)
-	um = fabs(uf);
-      H += (h[] + h[-1])/2.;
-    }
-    if (H > dry) {
-      double c = um/CFL + sqrt((G + max(sigma[], sigma[-1])/rhom*sq(pi/Delta))*
-			       (hydrostatic ? H : Delta*tanh(H/Delta)))/CFL_H;
-      double dt = min(cm[], cm[-1])*Delta/(c*fm.x[]);
-      if (dt < dtmax)
-	dtmax = dt;
-    }
-  }
+
+#if CAP_PRESSURE && !CAP_IMPLICIT
+  pcap = pool_scalar (1);
+  foreach()
+    pcap[] = wet_column() ? sigma_kappa (eta, 0) : 0.;
+  restriction_defer ({pcap});
+#endif
 }
 
 /**
 At the end of the timestep we delete the auxilliary field. */
 
 event pressure (i++) {
-  delete ({sigma_n});
+  pool_release ({sigma_n});
+#if CAP_PRESSURE && !CAP_IMPLICIT
+  pool_release ({pcap});
+#endif
 #if dimension > 1
-  delete ((scalar *){sigma_d});
+  pool_release ((scalar *){sigma_d});
 #endif  
 }
 
@@ -238,7 +277,6 @@ event viscous_term (i++)
         double l = sqrt(1. + sq(hx))/(1. - sq(hx));
         du_Mrg.x[] = dut.x[] + (l/nu)*(sigma[1] - sigma[-1])/(2*Delta);
       }
-    boundary ((scalar *){du_Mrg});
     dut = du_Mrg;
   }
 }
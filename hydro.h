@@ -45,7 +45,60 @@ in which case the tracers list is empty). */
 #define LAYERS 1
 #include "utils.h"
 
-scalar zb[], eta, h;
+/**
+The number of layers can also be fixed at compile time (e.g. with
+`-DNL=4`), in which case the column kernels (the [vertical
+diffusion](cap_diffusion.h) and [non-hydrostatic](nh.h) solvers) use
+fixed-size arrays and loops which the compiler can unroll. The number
+of layers *nl* must then be equal to *NL*.
+
+For a single layer, the column solves of the vertical diffusion and of
+the non-hydrostatic solver reduce to closed-form updates. The other
+parts of the timestep (face fields, advection of the tracer list,
+accelerations) still use the generic multilayer kernels: there is no
+dedicated single-layer (lubrication-like) engine. */
+
+#ifdef NL
+# define NLAYERS NL
+#else
+# define NLAYERS nl
+#endif
+
+/**
+The gradient limiter can also be fixed at compile time (e.g. with
+`-DGRADIENT=minmod2`), in which case it is used for all the fields
+(for which *s.gradient* is ignored) and the loops do not call it
+through a function pointer.
+
+This is required by the GPU backend of Basilisk (i.e. when *_GPU* is
+defined), which cannot call function pointers, print or use
+per-thread buffers within loops, nor allocate variable-length arrays.
+The limiter then defaults to *minmod2* (the default value of
+*gradient*, so that the results are the same as on the CPU) and the
+number of layers must be fixed using *NL*. The temporary fields are
+taken from the [pool](pool.h) and are thus only allocated once. */
+
+#if _GPU
+# ifndef NL
+#  error "the GPU backend requires a fixed number of layers (i.e. -DNL=...)"
+# endif
+# ifndef GRADIENT
+#  define GRADIENT minmod2
+# endif
+#endif
+
+#ifdef GRADIENT
+# define has_gradient(s) (true)
+# define limited_gradient(s, a, b, c) (GRADIENT (a, b, c))
+#else
+# define has_gradient(s) (s.gradient)
+# define limited_gradient(s, a, b, c) (s.gradient (a, b, c))
+#endif
+
+#include "pool.h"
+#include "profile.h"
+
+scalar zb[], eta, h, depth;
 vector u;
 double G = 1., dry = 1e-12, CFL_H = 1e40;
 double (* gradient) (double, double, double) = minmod2;
@@ -87,6 +140,12 @@ example for the [non-hydrostatic extension](nh.h)). */
 event defaults0 (i = 0)
 {
   assert (nl > 0);
+#ifdef NL
+  if (nl != NL) {
+    fprintf (stderr, "hydro.h: nl (%d) must be equal to NL (%d)\n", nl, NL);
+    exit (1);
+  }
+#endif
   h = new scalar[nl];
   h.gradient = gradient;
 #if TREE
@@ -94,6 +153,12 @@ event defaults0 (i = 0)
   h.restriction = restriction_volume_average;
 #endif
   eta = new scalar;
+  depth = new scalar;
+  depth.nodump = true;
+#if TREE
+  depth.refine = depth.prolongation = refine_linear;
+  depth.restriction = restriction_volume_average;
+#endif
   reset ({h, zb}, 0.);
 
   /**
@@ -153,15 +218,64 @@ event defaults (i = 0)
   display ("squares (color = 'eta > zb ? eta : nodata', spread = -1);");
 }
 
+/**
+The total depth $H = \sum_k h_k$ of each column is stored in
+*depth*. It is updated incrementally by [advect()](#advection-and-diffusion)
+and is recomputed by the function below after initialisation and mesh
+adaptation (note that modules which modify the layer thicknesses
+directly must also call this function). When *DEBUG_DEPTH* is defined,
+the incremental value is checked against the sum of layer thicknesses
+at the end of each timestep. */
+
+void update_depth()
+{
+  foreach() {
+    double H = 0.;
+    foreach_layer()
+      H += h[];
+    depth[] = H;
+  }
+}
+
+/**
+### Mesh changes
+
+At each [adaptation](#vertical-remapping-and-mesh-adaptation) step of
+a tree grid, the total depth is recomputed (since it is not refined
+consistently with the layer thicknesses) and *grid_generation* is
+incremented, which invalidates the [cached flux
+stencils](#fluxes-through-sections), the positions of the
+[probes](probes.h) etc. Neither the number of cells nor the
+statistics of *adapt_wavelet()* are reliable signals that the mesh
+has not changed (cells can be refined and coarsened in equal numbers
+and can be moved between processes by load balancing), so that this is
+done at every timestep.
+
+If the mesh is known to be static (i.e. it is neither adapted nor
+rebalanced), *grid_static* can be set to *true*, in which case nothing
+is done, unless *grid_adapted* is set to *true* (for example after an
+occasional call to *adapt_wavelet()*). */
+
+int grid_generation = 0;
+bool grid_static = false, grid_adapted = false;
+
 /**
 After user initialisation, we define the free-surface height $\eta$. */
 
 event init (i = 0)
 {
+#if UNIFORM_METRIC
+  bool uniform = is_constant (cm) && constant (cm) == 1.;
+  foreach_dimension()
+    uniform = uniform && is_constant (fm.x) && constant (fm.x) == 1.;
+  if (!uniform) {
+    fprintf (stderr, "hydro.h: UNIFORM_METRIC requires cm = fm = 1\n");
+    exit (1);
+  }
+#endif
+  update_depth();
   foreach() {
-    eta[] = zb[];
-    foreach_layer()
-      eta[] += h[];
+    eta[] = zb[] + depth[];
     dimensional (h[] == Delta);
   }
 }
@@ -171,14 +285,29 @@ The maximum timestep `dtmax` can be used to impose additional stability
 conditions. */
 
 double dtmax;
-event set_dtmax (i++,last) dtmax = DT;
+event set_dtmax (i++,last) {
+  profile_event (PROF_OTHER);
+  dtmax = DT;
+}
 
 /**
 The macro below can be overloaded to define the barotropic
 acceleration. By default it is just the slope of the free-surface
-times gravity. */
-
-#define gmetric(i) (2.*fm.x[i]/(cm[i] + cm[i-1]))
+times gravity.
+
+The metric factor of the gradients is simply one for Cartesian grids
+(i.e. with constant and unit *cm* and *fm*). Basilisk already
+specialises the loops for constant *cm* and *fm* fields, but the
+metric factors and the metric terms of the [pressure](#pressure)
+event can also be removed at compile time by defining
+*UNIFORM_METRIC* (e.g. with `-DUNIFORM_METRIC=1`). It is then checked
+that the metric is indeed uniform. */
+
+#if UNIFORM_METRIC
+# define gmetric(i) (1.)
+#else
+# define gmetric(i) (2.*fm.x[i]/(cm[i] + cm[i-1]))
+#endif
 #ifndef a_baro
 # define a_baro(eta, i) (G*gmetric(i)*(eta[i-1] - eta[i])/Delta)
 #endif
@@ -191,6 +320,23 @@ times gravity. */
 # define a_VdW(eta, i) (0)
 #endif
 
+/**
+Similarly, the "gravity" used to compute the celerity of gravity waves
+(and thus the timestep) can be increased by other modules, for example
+to take into account the celerity of capillary waves. */
+
+#ifndef g_cap
+# define g_cap(i) (0.)
+#endif
+
+#ifndef g_VdW
+# define g_VdW(i) (0.)
+#endif
+
+#ifndef g_tot
+# define g_tot(i) (G + g_cap(i) + g_VdW(i))
+#endif
+
 #ifndef a_tot
 //#define a_tot(eta,i) (a_baro(eta,i))
 #define a_tot(eta,i) (a_baro(eta,i) + a_cap(eta,i) + a_VdW(eta,i))
@@ -201,74 +347,179 @@ times gravity. */
 
 At each timestep, temporary face fields are defined for the fluxes $(h
 \mathbf{u})^{n+1/2}$, face height $h_f^{n+1/2}$ and height-weighted
-face accelerations $(ha)^{n+1/2}$. */
+face accelerations $(ha)^{n+1/2}$. They are taken from the [pool of
+temporary fields](pool.h). */
 
 
 static bool hydrostatic = true;
 face vector hu, hf, ha;
 
+/**
+## Dry columns
+
+When *dry_skip* is set, the field *wet* is positive for wet columns
+(i.e. with a total depth larger than *dry*) and for the columns within
+two cells (the width of the stencils) of a wet column. It is updated
+by [update_eta](#update_eta) and is restricted to all levels (see
+[below](#deferred-restrictions)). The
+kernels then skip the other (dry) columns and faces, for which the
+fluxes are zero.
+
+Note that the partitioning of the grid between processes does not take
+*wet* into account: the [load balancing](/src/grid/balance.h) of
+Basilisk only counts cells and has no per-cell weights. With MPI, the
+processes holding mostly dry regions thus have less work to do, and
+the other processes do not run faster. */
+
+bool dry_skip = false;
+scalar wet = {-1};
+
+/**
+## Deferred restrictions
+
+Several auxilliary fields (the *wet* mask, the non-linear surface
+tension coefficients, etc.) are only needed on coarse levels by the
+relaxation functions of the [implicit](implicit.h) and
+[non-hydrostatic](nh.h) solvers. Rather than being restricted
+separately, which requires a boundary exchange on each level for each
+call, they are added to *restriction_list* by *restriction_defer()*
+and restricted all together, once per timestep, by
+*restriction_flush()*.
+
+Note also that, since boundary conditions are applied automatically
+(and lazily) before the stencils which need them, all the fields
+modified in a given event are exchanged together (in one message per
+neighbour) by the first loop which reads them. Explicit calls to
+*boundary()* would force separate exchanges and are thus avoided. */
+
+scalar * restriction_list = NULL;
+
+void restriction_defer (scalar * list)
+{
+  for (scalar s in list)
+    restriction_list = list_add (restriction_list, s);
+}
+
+void restriction_flush (scalar * list)
+{
+  restriction_defer (list);
+  if (restriction_list) {
+    restriction (restriction_list);
+    free (restriction_list), restriction_list = NULL;
+  }
+}
+
+#define wet_column() (wet.i < 0 || wet[] > 0.)
+#define wet_face() (wet.i < 0 || wet[] > 0. || wet[-1] > 0.)
+
+static void update_wet()
+{
+  if (!dry_skip) {
+    if (wet.i >= 0)
+      pool_release ({wet}), wet.i = -1;
+    return;
+  }
+  if (wet.i < 0) {
+    wet = pool_scalar (1);
+#if TREE
+    wet.refine = wet.prolongation = refine_injection;
+#endif
+  }
+  scalar c = pool_scalar (1);
+  foreach()
+    c[] = depth[] > dry;
+  foreach() {
+    double a = 0.;
+#if dimension == 1
+    for (int i = -2; i <= 2; i++)
+      a = max (a, c[i]);
+#else
+    for (int i = -2; i <= 2; i++)
+      for (int j = -2; j <= 2; j++)
+	a = max (a, c[i,j]);
+#endif
+    wet[] = a;
+  }
+  restriction_defer ({wet});
+  pool_release ({c});
+}
+
+/**
+The estimated timestep used by [face_fields](#face_fields) below
+(and saved by [checkpoints](checkpoint.h)). */
+
+double pdt = 1e-6;
+
 event face_fields (i++, last)
 {
-  hu = new face vector[nl];
-  hf = new face vector[nl];
-  ha = new face vector[nl];
+  hu = pool_face_vector (nl);
+  hf = pool_face_vector (nl);
+  ha = pool_face_vector (nl);
+  if (dry_skip && wet.i < 0)
+    update_wet();
 
   /**
   The (CFL-limited) timestep is also computed by this function. A
   difficulty is that the prediction step below also requires an
-  estimated timestep (the `pdt` variable below). The timestep at the
+  estimated timestep (the `pdt` variable above). The timestep at the
   previous iteration is used as estimate. For the initial timestep a
   "sufficiently small" value is used. */
   
-  static double pdt = 1e-6;
   foreach_face (reduction (min:dtmax)) {
-    double ax = a_tot (eta, 0);
-    double H = 0., um = 0.;
-    foreach_layer() {
-
-      /**
-      The face velocity is computed as the height-weighted average of
-      the cell velocities. */
+    if (!wet_face())
+      foreach_layer()
+	hu.x[] = hf.x[] = ha.x[] = 0.;
+    else {
+      double ax = a_tot (eta, 0);
+      double H = 0., um = 0.;
+      foreach_layer() {
+
+	/**
+	The face velocity is computed as the height-weighted average of
+	the cell velocities. */
       
-      double hl = h[-1] > dry ? h[-1] : 0.;
-      double hr = h[] > dry ? h[] : 0.;
-      hu.x[] = hl > 0. || hr > 0. ? (hl*u.x[-1] + hr*u.x[])/(hl + hr) : 0.;
+	double hl = h[-1] > dry ? h[-1] : 0.;
+	double hr = h[] > dry ? h[] : 0.;
+	hu.x[] = hl > 0. || hr > 0. ? (hl*u.x[-1] + hr*u.x[])/(hl + hr) : 0.;
 
-      /**
-      The face height is computed using a variant of the
-      [BCG](/src/bcg.h) scheme. */
+	/**
+	The face height is computed using a variant of the
+	[BCG](/src/bcg.h) scheme. */
       
-      double hff, un = pdt*(hu.x[] + pdt*ax)/Delta, a = sign(un);
-      int i = - (a + 1.)/2.;
-      double g = h.gradient ? h.gradient (h[i-1], h[i], h[i+1])/Delta :
-	(h[i+1] - h[i-1])/(2.*Delta);
-      hff = h[i] + a*(1. - a*un)*g*Delta/2.;
-      hf.x[] = fm.x[]*hff;
-
-      /**
-      The maximum velocity is stored and the flux and height-weighted
-      accelerations are computed. */
+	double hff, un = pdt*(hu.x[] + pdt*ax)/Delta, a = sign(un);
+	int i = - (a + 1.)/2.;
+	double g = has_gradient (h) ?
+	  limited_gradient (h, h[i-1], h[i], h[i+1])/Delta :
+	  (h[i+1] - h[i-1])/(2.*Delta);
+	hff = h[i] + a*(1. - a*un)*g*Delta/2.;
+	hf.x[] = fm.x[]*hff;
+
+	/**
+	The maximum velocity is stored and the flux and height-weighted
+	accelerations are computed. */
       
-      if (fabs(hu.x[]) > um)
-	um = fabs(hu.x[]);
+	if (fabs(hu.x[]) > um)
+	  um = fabs(hu.x[]);
       
-      hu.x[] *= hf.x[];
-      ha.x[] = hf.x[]*ax;
+	hu.x[] *= hf.x[];
+	ha.x[] = hf.x[]*ax;
  
-      H += hff;
-    }
+	H += hff;
+      }
 
-    /**
-    The maximum timestep is computed using the total depth `H` and the
-    advection and gravity wave CFL criteria. The gravity wave speed
-    takes dispersion into account in the non-hydrostatic case. */
+      /**
+      The maximum timestep is computed using the total depth `H` and the
+      advection and gravity wave CFL criteria. The gravity wave speed
+      takes dispersion into account in the non-hydrostatic case. */
     
-    if (H > dry) {
-      double c = um/CFL + sqrt(G*(hydrostatic ? H : Delta*tanh(H/Delta)))/CFL_H;
-      if (c > 0.) {
-	double dt = min(cm[], cm[-1])*Delta/(c*fm.x[]);
-	if (dt < dtmax)
-	  dtmax = dt;
+      if (H > dry) {
+	double c = um/CFL +
+	  sqrt(g_tot(0)*(hydrostatic ? H : Delta*tanh(H/Delta)))/CFL_H;
+	if (c > 0.) {
+	  double dt = min(cm[], cm[-1])*Delta/(c*fm.x[]);
+	  if (dt < dtmax)
+	    dtmax = dt;
+	}
       }
     }
   }
@@ -278,11 +529,90 @@ event face_fields (i++, last)
   and also stored in `pdt` (see comment above). */
   
   pdt = dt = dtnext (dtmax);
+  profile_event (PROF_FACE_FIELDS);
 }
 
 /**
 ## Advection and diffusion
 
+### Diagnostics
+
+The number of flux limitations which could not conserve the
+barotropic flux, the number of negative layer heights and the most
+negative height (and its location) are accumulated by each thread
+during advection, rather than printed for each cell. They are reduced
+over threads at the end of each call of *advect()* and accumulated in
+*advect_diag*. They are then reduced over processes once per timestep,
+by the [update_eta](#update_eta) event, which prints a summary (on
+standard error, by the master process). For debugging, the location of
+each event can be printed by setting *advect_trace* to *true*. The
+diagnostics are not collected with the GPU backend. */
+
+typedef struct {
+  long nflux, nh;   // unbalanced flux limitations, negative heights
+  double hmin;      // most negative height
+  coord p;          // its position
+  int l;            // and layer
+} AdvectDiag;
+
+AdvectDiag advect_diag = {0};
+bool advect_trace = false;
+
+static int layered_nthreads (void)
+{
+#if _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+static int layered_tid (void)
+{
+#if _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+static void advect_reduce (AdvectDiag * diag, int nt)
+{
+  for (int j = 0; j < nt; j++) {
+    advect_diag.nflux += diag[j].nflux, advect_diag.nh += diag[j].nh;
+    if (diag[j].hmin < advect_diag.hmin)
+      advect_diag.hmin = diag[j].hmin, advect_diag.p = diag[j].p,
+	advect_diag.l = diag[j].l;
+  }
+}
+
+/**
+The reduction over processes only requires a single reduction of the
+counts, except on the timesteps with negative heights, for which the
+location of the minimum is also reduced. */
+
+static void advect_diag_reduce()
+{
+#if _MPI
+  long n[2] = {advect_diag.nflux, advect_diag.nh};
+  MPI_Allreduce (MPI_IN_PLACE, n, 2, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+  advect_diag.nflux = n[0], advect_diag.nh = n[1];
+  if (advect_diag.nh) {
+    struct { double h; int rank; } m = {advect_diag.hmin, pid()};
+    MPI_Allreduce (MPI_IN_PLACE, &m, 1, MPI_DOUBLE_INT, MPI_MINLOC,
+		   MPI_COMM_WORLD);
+    double p[4] = {advect_diag.p.x, advect_diag.p.y, advect_diag.p.z,
+		   advect_diag.l};
+    MPI_Bcast (p, 4, MPI_DOUBLE, m.rank, MPI_COMM_WORLD);
+    advect_diag.hmin = m.h;
+    advect_diag.p = (coord){p[0], p[1], p[2]}, advect_diag.l = p[3];
+  }
+#endif
+}
+
+/**
+### Advection
+
 The function below approximates the advection terms using estimates of
 the face fluxes $h\mathbf{u}$ and face heights $h_f$. */
 
@@ -294,6 +624,11 @@ void advect (scalar * tracers, face vector hu, face vector hf, double dt)
   ensure strict positivity of the layer heights. This step is
   necessary due to the approximate estimation of the CFL condition in
   the timestep calculation above. */
+
+  int nt = layered_nthreads();
+  AdvectDiag diag[nt];
+  for (int j = 0; j < nt; j++)
+    diag[j] = (AdvectDiag){0};
   
   foreach_face()
     foreach_layer() {
@@ -313,54 +648,69 @@ void advect (scalar * tracers, face vector hu, face vector hf, double dt)
       if (hul != hu.x[]) {
 	if (point.l < nl - 1)
 	  hu.x[0,0,1] += hu.x[] - hul;
-	else if (nl > 1)
-	  fprintf (stderr, "warning: could not conserve barotropic flux "
-		   "at %g,%g,%d\n", x, y, point.l);
+	else if (nl > 1) {
+#if !_GPU
+	  diag[layered_tid()].nflux++;
+	  if (advect_trace)
+	    fprintf (stderr, "warning: could not conserve barotropic flux "
+		     "at %g,%g,%d\n", x, y, point.l);
+#endif
+	}
 	hu.x[] = hul;
       }
     }
 
-  face vector flux[];
+  /**
+  The face geometry (the CFL number, upwind direction and transverse
+  velocity) is computed only once for all tracers and the fluxes of
+  each tracer are stored in temporary face fields taken from the
+  [pool](pool.h). */
+
+  vector * fluxes = NULL;
+  for (scalar s in tracers)
+    fluxes = vectors_append (fluxes, pool_face_vector (1));
   foreach_layer() {
         
     /**
     We compute the flux $(shu)_{i+1/2,k}$ for each tracer $s$, using a
     variant of the BCG scheme. */
     
-    for (scalar s in tracers) {
-      foreach_face() {
+    foreach_face() {
+      if (!wet_face())
+	for (vector flux in fluxes)
+	  flux.x[] = 0.;
+      else {
 	double un = dt*hu.x[]/((hf.x[] + dry)*Delta), a = sign(un);
 	int i = -(a + 1.)/2.;
-	double g = s.gradient ?
-	  s.gradient (s[i-1], s[i], s[i+1])/Delta :
-	  (s[i+1] - s[i-1])/(2.*Delta);
-	double s2 = s[i] + a*(1. - a*un)*g*Delta/2.;
+#if dimension > 1
+	bool transverse = (hf.y[i] + hf.y[i,1] > dry);
+	double vn = transverse ? (hu.y[i] + hu.y[i,1])/(hf.y[i] + hf.y[i,1]) : 0.;
+#endif
+	scalar s; vector flux;
+	for (s, flux in tracers, fluxes) {
+	  double g = has_gradient (s) ?
+	    limited_gradient (s, s[i-1], s[i], s[i+1])/Delta :
+	    (s[i+1] - s[i-1])/(2.*Delta);
+	  double s2 = s[i] + a*(1. - a*un)*g*Delta/2.;
 
 #if dimension > 1
-	if (hf.y[i] + hf.y[i,1] > dry) {
-	  double vn = (hu.y[i] + hu.y[i,1])/(hf.y[i] + hf.y[i,1]);
-	  double syy = (s.gradient ? s.gradient (s[i,-1], s[i], s[i,1]) :
-			vn < 0. ? s[i,1] - s[i] : s[i] - s[i,-1]);
-	  s2 -= dt*vn*syy/(2.*Delta);
-	}
+	  if (transverse) {
+	    double syy = (has_gradient (s) ?
+			  limited_gradient (s, s[i,-1], s[i], s[i,1]) :
+			  vn < 0. ? s[i,1] - s[i] : s[i] - s[i,-1]);
+	    s2 -= dt*vn*syy/(2.*Delta);
+	  }
 #endif // dimension > 1
 	
-	flux.x[] = s2*hu.x[];
-      }
-      
-      /**
-      We compute $(hs)^\star_i = (hs)^n_i + \Delta t 
-      [(shu)_{i+1/2} -(shu)_{i-1/2}]/\Delta$. */
-      
-      foreach() {
-	s[] *= h[];
-	foreach_dimension()
-	  s[] += dt*(flux.x[] - flux.x[1])/(Delta*cm[]);
+	  flux.x[] = s2*hu.x[];
+	}
       }
     }
 
     /**
-    We then obtain $h^{n+1}$ and $s^{n+1}$ using
+    We then compute $(hs)^\star_i = (hs)^n_i + \Delta t 
+    [(shu)_{i+1/2} -(shu)_{i-1/2}]/\Delta$ and obtain $h^{n+1}$ and
+    $s^{n+1}$ using
     $$
     \begin{aligned}
     h_i^{n+1} & = h_i^n + \Delta t \frac{(hu)_{i+1/2} - (hu)_{i-1/2}}{\Delta},\\
@@ -370,13 +720,29 @@ void advect (scalar * tracers, face vector hu, face vector hf, double dt)
     */
 
     foreach() {
-      double h1 = h[];
+      scalar s; vector flux;
+      for (s, flux in tracers, fluxes) {
+	s[] *= h[];
+	foreach_dimension()
+	  s[] += dt*(flux.x[] - flux.x[1])/(Delta*cm[]);
+      }
+      
+      double h0 = h[], h1 = h0;
       foreach_dimension()
 	h1 += dt*(hu.x[] - hu.x[1])/(Delta*cm[]);
-      if (h1 < - dry)
-	fprintf (stderr, "warning: h1 = %g < - 1e-12 at %g,%g,%d,%g\n",
-		 h1, x, y, _layer, t);
+#if !_GPU
+      if (h1 < - dry) {
+	AdvectDiag * d = diag + layered_tid();
+	d->nh++;
+	if (h1 < d->hmin)
+	  d->hmin = h1, d->p = (coord){x, y, z}, d->l = _layer;
+	if (advect_trace)
+	  fprintf (stderr, "warning: h1 = %g < - 1e-12 at %g,%g,%d,%g\n",
+		   h1, x, y, _layer, t);
+      }
+#endif
       h[] = fmax(h1, 0.);
+      depth[] += h[] - h0;
       if (h1 < dry) {
 	for (scalar f in tracers)
 	  f[] = 0.;
@@ -386,6 +752,10 @@ void advect (scalar * tracers, face vector hu, face vector hf, double dt)
 	  f[] /= h1;      
     }
   }
+  for (vector flux in fluxes)
+    pool_release ((scalar *){flux});
+  free (fluxes);
+  advect_reduce (diag, nt);
 }
 
 /**
@@ -393,7 +763,7 @@ This is where the 'two-step advection' of the [implicit
 scheme](implicit.h) plugs itself (nothing is done for the explicit
 scheme). */
 
-event half_advection (i++, last);
+event half_advection (i++, last) profile_event (PROF_HALF_ADVECTION);
 
 /**
 Vertical diffusion (including viscosity) is added by this code. */
@@ -408,11 +778,17 @@ Acceleration terms are added here. In the simplest case, this is only
 the pressure gradient due to the free-surface slope, as computed in
 [face_fields](#face_fields). */
 
-event acceleration (i++, last);
+event acceleration (i++, last) profile_event (PROF_ACCELERATION);
 
 event pressure (i++, last)
 {
 
+  /**
+  The deferred restrictions which have not already been done by a
+  solver are done here. */
+
+  restriction_flush (NULL);
+
   /**
   The acceleration is applied to the face fluxes... */
   
@@ -427,7 +803,7 @@ event pressure (i++, last)
     foreach_layer() {
       foreach_dimension()
 	u.x[] += dt*(ha.x[] + ha.x[1])/(hf.x[] + hf.x[1] + dry);
-#if dimension == 2
+#if dimension == 2 && !UNIFORM_METRIC
       // metric terms
       double dmdl = (fm.x[1,0] - fm.x[])/(cm[]*Delta);
       double dmdt = (fm.y[0,1] - fm.y[])/(cm[]*Delta);
@@ -435,15 +811,18 @@ event pressure (i++, last)
       double fG = uy*dmdl - ux*dmdt;
       u.x[] += dt*fG*uy;
       u.y[] -= dt*fG*ux;
-#endif // dimension == 2
+#endif // dimension == 2 && !UNIFORM_METRIC
     }
-  delete ((scalar *){ha});
+  pool_release ((scalar *){ha});
 
   /**
   The resulting fluxes are used to advect both tracers and layer
   heights. */
   
+  profile_start (PROF_ADVECT);
   advect (tracers, hu, hf, dt);
+  profile_stop (PROF_ADVECT);
+  profile_event (PROF_PRESSURE);
 }
   
 /**
@@ -452,13 +831,39 @@ conditions are applied. */
 
 event update_eta (i++, last)
 {
-  delete ((scalar *){hu, hf});
-  foreach() {
-    double etap = zb[];
+  pool_release ((scalar *){hu, hf});
+#if DEBUG_DEPTH
+  double err = 0.;
+  foreach (reduction(max:err)) {
+    double H = 0.;
     foreach_layer()
-      etap += h[];
-    eta[] = etap;
+      H += h[];
+    if (fabs (H - depth[]) > err)
+      err = fabs (H - depth[]);
+  }
+  if (err > dry)
+    fprintf (stderr, "warning: depth error %g at t = %g\n", err, t);
+#endif
+  foreach()
+    eta[] = zb[] + depth[];
+  update_wet();
+  advect_diag_reduce();
+  if (advect_diag.nflux || advect_diag.nh) {
+    if (pid() == 0) {
+      if (advect_diag.nflux)
+	fprintf (stderr, "warning: could not conserve barotropic flux "
+		 "for %ld faces at t = %g\n", advect_diag.nflux, t);
+      if (advect_diag.nh)
+	fprintf (stderr, "warning: %ld negative heights at t = %g, "
+		 "minimum h1 = %g at %g,%g,%g,%d\n", advect_diag.nh, t,
+		 advect_diag.hmin, advect_diag.p.x, advect_diag.p.y,
+		 advect_diag.p.z, advect_diag.l);
+    }
+    profile_count (PROF_FLUX_LIMIT, advect_diag.nflux);
+    profile_count (PROF_NEGATIVE_H, advect_diag.nh);
+    advect_diag = (AdvectDiag){0};
   }
+  profile_event (PROF_UPDATE_ETA);
 }
 
 /**
@@ -466,10 +871,22 @@ event update_eta (i++, last)
 
 [Vertical remapping](remap.h) is applied here if necessary. */
 
-event remap (i++, last);
- 
+event remap (i++, last) profile_event (PROF_REMAP);
+
+/**
+After adaptation, the total depth is recomputed and *grid_generation*
+is incremented, unless the mesh is static (see
+[above](#mesh-changes)). */
+
 #if TREE
-event adapt (i++,last);
+event adapt (i++,last) {
+  if (!grid_static || grid_adapted) {
+    update_depth();
+    grid_generation++;
+  }
+  grid_adapted = false;
+  profile_event (PROF_ADAPT);
+}
 #endif
 
 /**
@@ -480,8 +897,11 @@ must be freed at the end of the run. */
    
 event cleanup (t = end, last)
 {
-  delete ({eta, h, u});
+  delete ({eta, h, u, depth});
   free (tracers), tracers = NULL;
+  free (restriction_list), restriction_list = NULL;
+  pool_free();
+  profile_free();
 }
 
 /**
@@ -661,6 +1081,7 @@ void conserve_layered_elevation (void)
 #endif // TREE
 
 #include "gauges.h"
+#include "probes.h"
 
 #if dimension == 2
 
@@ -719,33 +1140,162 @@ A NULL-terminated array of *Flux* structures passed to
 flux. Each time *output_fluxes()* is called a line will be appended to
 the file. The line contains the time, the total flux and the value of
 the flux for each $h$, $u$ pair in the layer. The *desc* field can be
-filled with a longer description of the flux. */
+filled with a longer description of the flux.
+
+When monitoring many sections frequently, *flux_cache* can be set to
+*true*. The cells crossed by each segment and the corresponding
+bilinear interpolation weights are then computed once and stored in
+the *stencils* array of each flux, until the grid is
+[adapted](#mesh-changes) (the number of times the stencils of a flux
+have been computed is stored in its *builds* field). The fluxes
+through all the sections are reduced over processes together and the
+file of each flux is only flushed every *flux_flush* calls. If
+*flux_binary* is set, each
+line is replaced by $n_l + 2$ double-precision values (in the same
+order). The files and the caches are freed by *free_fluxes()*. */
+
+typedef struct {
+  Point p;
+  int i, j;       // direction of the neighbours
+  double w[4];    // bilinear weights
+  double dl;      // half the elementary length
+} FluxStencil;
 
 typedef struct {
   char * name;
   coord s[2];
   char * desc;
   FILE * fp;
+  Array * stencils;
+  int generation, builds; // generation and number of builds of the stencils
+  int calls;              // number of calls since the last flush
 } Flux;
 
+bool flux_cache = false, flux_binary = false;
+int flux_flush = 100;
+
+static void flux_stencils (Flux * f)
+{
+  if (!f->stencils)
+    f->stencils = array_new();
+  f->stencils->len = 0;
+  foreach_segment (f->s, p) {
+    double dl = 0.;
+    foreach_dimension() {
+      double dp = (p[1].x - p[0].x)*Delta/Delta_x*(fm.y[] + fm.y[0,1])/2.;
+      dl += sq(dp);
+    }
+    dl = sqrt (dl);
+    for (int i = 0; i < 2; i++) {
+      double a = (p[i].x - x)/Delta, b = (p[i].y - y)/Delta;
+      FluxStencil c = {point, sign(a), sign(b)};
+      a = fabs(a), b = fabs(b);
+      c.w[0] = (1. - a)*(1. - b), c.w[1] = a*(1. - b);
+      c.w[2] = (1. - a)*b, c.w[3] = a*b;
+      c.dl = dl/2.;
+      array_append (f->stencils, &c, sizeof(FluxStencil));
+    }
+  }
+  f->generation = grid_generation;
+  f->builds++;
+}
+
+#define stencil_linear(s) (c->w[0]*s[] + c->w[1]*s[c->i] +		\
+			   c->w[2]*s[0,c->j] + c->w[3]*s[c->i,c->j])
+
+static void flux_stencils_sum (Flux * f, double * flux, scalar h, vector u)
+{
+  coord m = {f->s[0].y - f->s[1].y, f->s[1].x - f->s[0].x};
+  normalize (&m);
+  FluxStencil * c = f->stencils->p;
+  for (int k = 0; k < f->stencils->len/sizeof(FluxStencil); k++, c++) {
+    Point point = c->p;
+    foreach_layer()
+      flux[point.l] += c->dl*stencil_linear (h)*
+      (m.x*stencil_linear (u.x) + m.y*stencil_linear (u.y));
+  }
+}
+
+#undef stencil_linear
+
+static void flux_write (Flux * f, double tot, double * flux, bool flush)
+{
+  if (!f->fp) {
+    f->fp = fopen (f->name, "w");
+    if (f->desc && !flux_binary)
+      fprintf (f->fp, "%s\n", f->desc);
+  }
+  if (flux_binary) {
+    double a[2] = {t, tot};
+    fwrite (a, sizeof(double), 2, f->fp);
+    fwrite (flux, sizeof(double), nl, f->fp);
+  }
+  else {
+    fprintf (f->fp, "%g %g", t, tot);
+    for (int i = 0; i < nl; i++)
+      fprintf (f->fp, " %g", flux[i]);
+    fputc ('\n', f->fp);
+  }
+  if (flush)
+    fflush (f->fp);
+}
+
 void output_fluxes (Flux * fluxes, scalar h, vector u)
 {
-  for (Flux * f = fluxes; f->name; f++) {
-    double flux[nl];
-    double tot = segment_flux (f->s, flux, h, u);
-    if (pid() == 0) {
-      if (!f->fp) {
-	f->fp = fopen (f->name, "w");
-	if (f->desc)
-	  fprintf (f->fp, "%s\n", f->desc);
-      }
-      fprintf (f->fp, "%g %g", t, tot);
-      for (int i = 0; i < nl; i++)
-	fprintf (f->fp, " %g", flux[i]);
-      fputc ('\n', f->fp);
-      fflush (f->fp);
+  if (!flux_cache) {
+    for (Flux * f = fluxes; f->name; f++) {
+      double flux[nl];
+      double tot = segment_flux (f->s, flux, h, u);
+      if (pid() == 0)
+	flux_write (f, tot, flux, true);
+    }
+    return;
+  }
+
+  int n = 0;
+  for (Flux * f = fluxes; f->name; f++)
+    n++;
+  double flux[n*nl];
+  for (int k = 0; k < n*nl; k++)
+    flux[k] = 0.;
+
+  /**
+  The stencils are evaluated outside of any *foreach()* loop, so that
+  the ghost values of $h$ and $\mathbf{u}$ must be updated first. */
+  
+  boundary ({h, u});
+  n = 0;
+  for (Flux * f = fluxes; f->name; f++, n++) {
+    if (!f->stencils || f->generation != grid_generation)
+      flux_stencils (f);
+    flux_stencils_sum (f, flux + n*nl, h, u);
+  }
+#if _MPI
+  MPI_Allreduce (MPI_IN_PLACE, flux, n*nl, MPI_DOUBLE, MPI_SUM,
+		 MPI_COMM_WORLD);
+#endif
+  if (pid() == 0) {
+    n = 0;
+    for (Flux * f = fluxes; f->name; f++, n++) {
+      double tot = 0.;
+      for (int l = 0; l < nl; l++)
+	tot += flux[n*nl + l];
+      bool flush = (++f->calls >= flux_flush);
+      if (flush)
+	f->calls = 0;
+      flux_write (f, tot, flux + n*nl, flush);
     }
   }
 }
 
+void free_fluxes (Flux * fluxes)
+{
+  for (Flux * f = fluxes; f->name; f++) {
+    if (f->fp)
+      fclose (f->fp), f->fp = NULL;
+    if (f->stencils)
+      array_free (f->stencils), f->stencils = NULL;
+  }
+}
+
 #endif // dimension == 2
@@ -16,12 +16,16 @@ $$
 where $\theta_H$ is the "implicitness parameter" typically set to $1/2$. 
 
 The resulting Poisson--Helmholtz equation for $\eta^{n+1}$ is solved
-using the multigrid Poisson solver. The convergence statistics are
-stored in `mgH`. */
+using the multigrid Poisson solver or, optionally, the
+[multigrid-preconditioned Krylov solver](krylov.h). The convergence
+statistics are stored in `mgH` and the residual history of the Krylov
+solver in `mgH_history`. */
 
 #include "poisson.h"
+#include "krylov.h"
 
 mgstats mgH;
+Array * mgH_history = NULL;
 double theta_H = 0.5;
 
 #define IMPLICIT_H 1
@@ -56,6 +60,7 @@ $$
 trace
 static void relax_hydro (scalar * ql, scalar * rhsl, int lev, void * data)
 {
+  profile_start (PROF_RELAX_HYDRO);
   scalar eta = ql[0], rhs_eta = rhsl[0];
   face vector alpha = *((vector *)data);
   foreach_level_or_leaf (lev) {
@@ -70,12 +75,14 @@ static void relax_hydro (scalar * ql, scalar * rhsl, int lev, void * data)
     }
     eta[] = n/d;
   }
+  profile_stop (PROF_RELAX_HYDRO);
 }
 
 trace
 static double residual_hydro (scalar * ql, scalar * rhsl,
 			      scalar * resl, void * data)
 {
+  profile_start (PROF_RESIDUAL_HYDRO);
   scalar eta = ql[0], rhs_eta = rhsl[0], res_eta = resl[0];
   face vector alpha = *((vector *)data);
   double maxres = 0.;
@@ -91,6 +98,7 @@ static double residual_hydro (scalar * ql, scalar * rhsl,
       maxres = fabs(res_eta[]);
   }
 
+  profile_stop (PROF_RESIDUAL_HYDRO);
   return maxres;
 }
 
@@ -99,6 +107,227 @@ This can be used to optionally store the residual (for debugging). */
 
 scalar res_eta = {-1};
 
+/**
+## Extrapolated initial guess
+
+The solutions of the multigrid solvers are smooth in time, so that the
+initial guess can be extrapolated from the solutions at the previous
+timesteps rather than taken as the solution at the previous
+timestep. The extrapolation is linear in time when *extrapolation* is
+set to one and quadratic when it is set to two (it is not done by
+default).
+
+The function below stores the current solution in the history, then
+replaces it with the extrapolated guess at time *tn*. The number of
+iterations saved by the extrapolation is estimated (and stored in the
+*saved* field) once the solution is obtained, by comparing the initial
+residual of the solver with that of the previous solve. This is only
+an estimate, but it avoids an additional residual computation. The
+history is initialised to zero, so that the weights of the solutions
+which are not yet available are applied to finite values. */
+
+int extrapolation = 0;
+
+typedef struct {
+  char * name;   // the prefix of the names of the fields below
+  scalar * p[2]; // the solutions at the two previous timesteps
+  double t[3];   // the times of the current and previous solutions
+  int n;         // the number of solutions available
+  double resb;   // the initial residual of the previous solve
+  double saved;  // the estimated number of iterations saved
+} Guess;
+
+/**
+The fields of the history are named using the prefix of the history
+and the names of the solution fields, so that they can be
+[dumped](checkpoint.h). */
+
+static void guess_alloc (Guess * g, scalar * a)
+{
+  for (int j = 0; j < 2; j++) {
+    g->p[j] = list_clone (a);
+    reset (g->p[j], 0.);
+    scalar s, sa;
+    for (s, sa in g->p[j], a) {
+#if TREE
+      s.refine = s.prolongation = refine_linear;
+      s.restriction = restriction_volume_average;
+#endif
+      for (int b = 0; b < s.block; b++) {
+	scalar c = {s.i + b}, ca = {sa.i + b};
+	char name[strlen(g->name) + strlen(ca.name) + 20];
+	sprintf (name, "%s%d_%s", g->name, j, ca.name);
+	free (c.name);
+	c.name = strdup (name);
+      }
+    }
+  }
+}
+
+static void guess_extrapolate (Guess * g, scalar * a, double tn)
+{
+  if (!extrapolation || g->n == 0)
+    return;
+  if (!g->p[0])
+    guess_alloc (g, a);
+  
+  /**
+  The weights are those of the Lagrange polynomial through the
+  available solutions. */
+  
+  int n = min (extrapolation, g->n - 1) + 1;
+  double w[3] = {1., 0., 0.};
+  for (int i = 0; i < n; i++) {
+    w[i] = 1.;
+    for (int j = 0; j < n; j++)
+      if (j != i)
+	w[i] *= (tn - g->t[j])/(g->t[i] - g->t[j]);
+  }
+  
+  scalar * p0 = g->p[0], * p1 = g->p[1];
+  foreach() {
+    scalar s, s1, s2;
+    for (s, s1, s2 in a, p0, p1)
+      foreach_blockf (s) {
+	double v0 = s[], v1 = s1[], v2 = s2[];
+	s2[] = v1, s1[] = v0;
+	s[] = w[0]*v0 + w[1]*v1 + w[2]*v2;
+      }
+  }
+  g->t[2] = g->t[1], g->t[1] = g->t[0];
+}
+
+/**
+This function must be called once the solution at time *tn* is
+obtained. */
+
+static void guess_update (Guess * g, mgstats s, double tn)
+{
+  g->saved = 0.;
+  if (extrapolation && g->n > 1 && s.i > 0 && s.resa < s.resb &&
+      g->resb > s.resb)
+    g->saved = s.i*log(g->resb/s.resb)/log(s.resb/s.resa);
+  g->resb = s.resb;
+  g->t[0] = tn;
+  g->n = min (g->n + 1, 3);
+}
+
+static void guess_free (Guess * g)
+{
+  for (int j = 0; j < 2; j++)
+    if (g->p[j])
+      delete (g->p[j]), free (g->p[j]), g->p[j] = NULL;
+}
+
+/**
+The number of iterations saved for the solution of the Poisson--Helmholtz
+equation is stored in *mgH_guess.saved*. */
+
+Guess mgH_guess = {"mgH"};
+
+/**
+## Adaptive coarsening
+
+Thin films (or very deep layers) lead to strongly anisotropic
+systems. For the Poisson--Helmholtz equation, the horizontal coupling
+relative to the diagonal term is of order $g|\alpha|/(\Delta^2c_m)$
+and, for the [non-hydrostatic solver](nh.h), the ratio of the
+horizontal to the vertical coupling in the columns is of order
+$(h/\Delta)^2$. Since the layers are not coarsened and the columns are
+solved directly by the [relaxation function](nh.h#relax_nh), the
+multigrid hierarchy only needs to deal with the horizontal coupling,
+which decreases as the levels get coarser. On levels where it is small
+everywhere, relaxation is close to an exact solution and coarser
+levels only add cost (and can slow down convergence).
+
+The function below computes the minimum and maximum couplings on each
+level (stored in *mg_levels*) and returns the finest level below which
+the couplings are all smaller than *mg_coupling* (i.e. the finest level
+on which they are small), which is then used as the coarsest level of
+the multigrid hierarchy. This is only done if *mg_coupling* is
+positive. Note that the (possible) capillary contributions to
+$a_{baro}$ are not taken into account.
+
+This requires reductions on all levels, so that the coarsest level is
+cached for each solver and only recomputed when the mesh may have
+[changed](hydro.h#mesh-changes) (i.e. at each timestep for tree grids,
+unless *grid_static* is set) or when the timestep has changed by
+more than a factor of two (the coupling of the Poisson--Helmholtz
+equation is proportional to $\Delta t^2$). The variations of the
+layer thicknesses between mesh changes are neglected. The statistics
+are those of the last evaluation. */
+
+double mg_coupling = 0.;
+
+typedef struct {
+  double eta[2], phi[2]; // the minimum and maximum couplings
+} MGLevel;
+
+MGLevel * mg_levels = NULL;
+
+typedef struct {
+  int generation, level; // the cached coarsest level
+  double dt;             // and the timestep for which it was computed
+} MGCoupling;
+
+static MGCoupling mg_coupling_cache[2] = {{-1}, {-1}};
+
+static int coupling_minlevel (face vector alpha, bool layers, int minlevel)
+{
+  MGCoupling * c = mg_coupling_cache + layers;
+  if (c->generation == grid_generation && dt < 2.*c->dt && 2.*dt > c->dt)
+    return c->level;
+  
+  int depth = grid->maxdepth, level = minlevel;
+  mg_levels = qrealloc (mg_levels, depth + 1, MGLevel);
+  for (int l = depth; l >= 0; l--) {
+    double emin = HUGE, emax = 0., pmin = HUGE, pmax = 0.;
+    foreach_level (l, reduction(min:emin) reduction(max:emax)
+		   reduction(min:pmin) reduction(max:pmax)) {
+      double e = 0.;
+      foreach_dimension()
+	e += fabs(alpha.x[]) + fabs(alpha.x[1]);
+      e *= G/(sq(Delta)*cm[]);
+      if (e < emin) emin = e;
+      if (e > emax) emax = e;
+      if (layers)
+	foreach_layer() {
+	  double p = sq(h[]/Delta)/cm[];
+	  if (p < pmin) pmin = p;
+	  if (p > pmax) pmax = p;
+	}
+    }
+    if (!layers)
+      pmin = pmax = 0.;
+    mg_levels[l] = (MGLevel){{emin, emax}, {pmin, pmax}};
+    if (level == minlevel && l > minlevel &&
+	emax <= mg_coupling && pmax <= mg_coupling)
+      level = l;
+  }
+  c->generation = grid_generation, c->level = level, c->dt = dt;
+  return level;
+}
+
+/**
+The average convergence rate (per cycle) and the hierarchy can be
+displayed using the functions below. */
+
+double mg_rate (mgstats s)
+{
+  return s.i > 0 && s.resb > 0. ? pow (s.resa/s.resb, 1./s.i) : 0.;
+}
+
+void mg_print_levels (FILE * fp, mgstats s)
+{
+  fprintf (fp, "# i: %d rate: %g minlevel: %d\n", s.i, mg_rate (s),
+	   s.minlevel);
+  if (mg_levels)
+    for (int l = s.minlevel; l <= grid->maxdepth; l++)
+      fprintf (fp, "%d %g %g %g %g\n", l,
+	       mg_levels[l].eta[0], mg_levels[l].eta[1],
+	       mg_levels[l].phi[0], mg_levels[l].phi[1]);
+}
+
 scalar rhs_eta;
 face vector alpha_eta;
 
@@ -125,7 +354,7 @@ equation are computed using the flux values at the "half-timestep". */
 event acceleration (i++)
 {    
   face vector su[];
-  alpha_eta = new face vector;
+  alpha_eta = pool_face_vector (1);
   double C = - sq(theta_H*dt);
   foreach_face() {
     double ax = theta_H*a_baro (eta, 0);
@@ -150,7 +379,7 @@ event acceleration (i++)
   $$
   */
   
-  rhs_eta = new scalar;
+  rhs_eta = pool_scalar (1);
   foreach() {
     rhs_eta[] = eta[];
     foreach_dimension()
@@ -160,10 +389,12 @@ event acceleration (i++)
   /**
   The fields used by the relaxation function above (and/or by the
   [relaxation function](nh.h#relax_nh) of the non-hydrostatic solver)
-  need to be restricted to all levels. */
+  need to be restricted to all levels. This is done together with the
+  [deferred restrictions](hydro.h#deferred-restrictions) of the other
+  modules. */
   
   // fixme: what about fm?
-  restriction ({cm, zb, h, hf, alpha_eta});
+  restriction_flush ({cm, zb, h, hf, alpha_eta});
 
   /**
   The restriction function for $\eta$, which has been modified by the
@@ -184,11 +415,34 @@ gradient term. */
 
 event pressure (i++)
 {
-  mgH = mg_solve ({eta}, {rhs_eta}, residual_hydro, relax_hydro, &alpha_eta,
-		  res = res_eta.i >= 0 ? (scalar *){res_eta} : NULL,
-		  nrelax = 4, minlevel = 1,
-		  tolerance = TOLERANCE);
-  delete ({rhs_eta, alpha_eta});
+
+  /**
+  With the [non-hydrostatic solver](nh.h), the initial guess is the
+  solution of the coupled system, so that it is not extrapolated. */
+
+#if !NH
+  guess_extrapolate (&mgH_guess, {eta}, t + dt);
+#endif
+  int minlevel = mg_coupling > 0. ? coupling_minlevel (alpha_eta, false, 1) : 1;
+  if (krylov) {
+    if (!mgH_history)
+      mgH_history = array_new();
+    mgH = krylov_solve ({eta}, {rhs_eta}, residual_hydro, relax_hydro,
+			&alpha_eta,
+			res = res_eta.i >= 0 ? (scalar *){res_eta} : NULL,
+			nrelax = 4, minlevel = minlevel,
+			tolerance = TOLERANCE, history = mgH_history);
+  }
+  else
+    mgH = mg_solve ({eta}, {rhs_eta}, residual_hydro, relax_hydro, &alpha_eta,
+		    res = res_eta.i >= 0 ? (scalar *){res_eta} : NULL,
+		    nrelax = 4, minlevel = minlevel,
+		    tolerance = TOLERANCE);
+  profile_solver (PROF_MGH, mgH);
+#if !NH
+  guess_update (&mgH_guess, mgH, t + dt);
+#endif
+  pool_release ({rhs_eta, alpha_eta});
 
   /**
   The restriction function for $\eta$ is restored. */
@@ -221,6 +475,14 @@ event pressure (i++)
   }
 }
 
+event cleanup (t = end)
+{
+  guess_free (&mgH_guess);
+  if (mgH_history)
+    array_free (mgH_history), mgH_history = NULL;
+  free (mg_levels), mg_levels = NULL;
+}
+
 /**
 ## References
 
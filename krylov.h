@@ -0,0 +1,207 @@
+/**
+# Multigrid-preconditioned Krylov solver
+
+This is a (flexible) restarted GMRES solver, which uses a single
+multigrid V-cycle as (right) preconditioner. It takes the same
+arguments as the [multigrid solver](/src/poisson.h#mg_solve) and can
+thus be used as a drop-in replacement for the [non-hydrostatic](nh.h)
+and [Poisson--Helmholtz](implicit.h) solvers, which is done by
+setting *krylov* to *true*.
+
+The systems and the V-cycles are not symmetric (in particular for the
+coupled $\phi$/$\eta$ system), so that conjugate gradients cannot be
+used.
+
+The number of iterations (i.e. of V-cycles) is returned in the
+*mgstats* structure, as for the multigrid solver. The (estimated)
+maximum residual after each iteration can optionally be stored in the
+*history* array. */
+
+bool krylov = false;
+int krylov_restart = 8;
+
+static double krylov_dot (scalar * a, scalar * b)
+{
+  double sum = 0.;
+  foreach (reduction(+:sum)) {
+    scalar s, t;
+    for (s, t in a, b)
+      foreach_blockf (s)
+	sum += s[]*t[];
+  }
+  return sum;
+}
+
+static void krylov_axpy (scalar * y, double alpha, scalar * x)
+{
+  foreach() {
+    scalar s, t;
+    for (s, t in y, x)
+      foreach_blockf (s)
+	s[] += alpha*t[];
+  }
+}
+
+static void krylov_scale (scalar * y, double alpha, scalar * x)
+{
+  foreach() {
+    scalar s, t;
+    for (s, t in y, x)
+      foreach_blockf (s)
+	s[] = alpha*t[];
+  }
+}
+
+
+struct KrylovSolve {
+  scalar * a, * b;
+  double (* residual) (scalar * a, scalar * b, scalar * res, void * data);
+  void (* relax) (scalar * da, scalar * res, int depth, void * data);
+  void * data;
+  int nrelax;
+  scalar * res;
+  int minlevel;
+  double tolerance;
+  Array * history;
+};
+
+trace
+mgstats krylov_solve (struct KrylovSolve p)
+{
+  mgstats s = {0};
+  s.nrelax = p.nrelax > 0 ? p.nrelax : 4;
+  s.minlevel = p.minlevel;
+  double tolerance = p.tolerance ? p.tolerance : TOLERANCE;
+  if (p.history)
+    p.history->len = 0;
+
+  double sum = 0.;
+  foreach (reduction(+:sum))
+    for (scalar a in p.b)
+      foreach_blockf (a)
+	sum += a[];
+  s.sum = sum;
+
+  scalar * res = p.res ? p.res : pool_clone (p.b, false);
+  s.resb = s.resa = p.residual (p.a, p.b, res, p.data);
+
+  /**
+  The Krylov basis $V$ and the preconditioned vectors $Z$ (with
+  homogeneous boundary conditions) are taken from the [pool](pool.h)
+  only if the initial guess does not already satisfy the
+  tolerance. */
+
+  int m = max (krylov_restart, 1);
+  scalar * V[m + 1], * Z[m], * da = NULL;
+  for (int j = 0; j <= m; j++)
+    V[j] = NULL;
+  for (int j = 0; j < m; j++)
+    Z[j] = NULL;
+
+  while (s.i < NITERMAX && (s.i < NITERMIN || s.resa > tolerance)) {
+    if (!da) {
+      da = pool_clone (p.a, false);
+      for (int j = 0; j <= m; j++)
+	V[j] = pool_clone (p.b, true);
+      for (int j = 0; j < m; j++)
+	Z[j] = pool_clone (p.a, true);
+    }
+
+    /**
+    The Arnoldi process starts from the (normalised) true residual. */
+
+    double beta = sqrt (krylov_dot (res, res));
+    if (beta == 0.)
+      break;
+    double H[m + 1][m], cs[m], sn[m], g[m + 1];
+    g[0] = beta;
+    krylov_scale (V[0], 1./beta, res);
+
+    int k = 0;
+    while (k < m && s.i < NITERMAX) {
+
+      /**
+      The preconditioned vector is a single V-cycle from a zero initial
+      guess. */
+
+      reset (Z[k], 0.);
+      mg_cycle (Z[k], V[k], da, p.relax, p.data, s.nrelax, s.minlevel,
+		grid->maxdepth);
+
+      /**
+      The residual function is used to compute $A Z_k=V_k-(V_k-AZ_k)$. */
+
+      p.residual (Z[k], V[k], V[k + 1], p.data);
+      krylov_scale (V[k + 1], -1., V[k + 1]);
+      krylov_axpy (V[k + 1], 1., V[k]);
+
+      /**
+      Modified Gram--Schmidt orthogonalisation. */
+
+      for (int i = 0; i <= k; i++) {
+	H[i][k] = krylov_dot (V[k + 1], V[i]);
+	krylov_axpy (V[k + 1], - H[i][k], V[i]);
+      }
+      H[k + 1][k] = sqrt (krylov_dot (V[k + 1], V[k + 1]));
+      bool breakdown = (H[k + 1][k] == 0.);
+      if (!breakdown)
+	krylov_scale (V[k + 1], 1./H[k + 1][k], V[k + 1]);
+
+      /**
+      The Hessenberg matrix is reduced to triangular form using Givens
+      rotations, which also gives an estimate of the residual. */
+
+      for (int i = 0; i < k; i++) {
+	double t = cs[i]*H[i][k] + sn[i]*H[i + 1][k];
+	H[i + 1][k] = - sn[i]*H[i][k] + cs[i]*H[i + 1][k];
+	H[i][k] = t;
+      }
+      double r = sqrt (sq(H[k][k]) + sq(H[k + 1][k]));
+      cs[k] = r > 0. ? H[k][k]/r : 1., sn[k] = r > 0. ? H[k + 1][k]/r : 0.;
+      H[k][k] = r, H[k + 1][k] = 0.;
+      g[k + 1] = - sn[k]*g[k], g[k] *= cs[k];
+      k++, s.i++;
+
+      /**
+      The estimated residual is rescaled using the maximum norm of the
+      initial residual of the cycle. */
+
+      double est = s.resa*fabs(g[k])/beta;
+      if (p.history)
+	array_append (p.history, &est, sizeof(double));
+      if ((est <= tolerance && s.i >= NITERMIN) || breakdown)
+	break;
+    }
+
+    /**
+    The solution is updated using the preconditioned vectors and the
+    true residual is computed. */
+
+    double y[k];
+    for (int i = k - 1; i >= 0; i--) {
+      y[i] = g[i];
+      for (int j = i + 1; j < k; j++)
+	y[i] -= H[i][j]*y[j];
+      y[i] /= H[i][i];
+    }
+    for (int i = 0; i < k; i++)
+      krylov_axpy (p.a, y[i], Z[i]);
+    s.resa = p.residual (p.a, p.b, res, p.data);
+  }
+
+  if (s.resa > tolerance)
+    fprintf (ferr, "WARNING: Krylov solver did not converge after %d iterations\n"
+	     "  res: %g sum: %g nrelax: %d tolerance: %g\n", s.i, s.resa,
+	     s.sum, s.nrelax, tolerance), fflush (ferr);
+
+  if (da) {
+    pool_release (da), free (da);
+    for (int j = 0; j <= m; j++)
+      pool_release (V[j]), free (V[j]);
+    for (int j = 0; j < m; j++)
+      pool_release (Z[j]), free (Z[j]);
+  }
+  if (!p.res)
+    pool_release (res), free (res);
+  return s;
+}
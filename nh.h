@@ -23,7 +23,11 @@ $$
 where the terms in blue are non-hydrostatic.
 
 The additional $w_k$ and $\phi_k$ fields are defined. The convergence
-statistics of the multigrid solver are stored in *mgp*.
+statistics of the multigrid solver are stored in *mgp*, the residual
+history of the [Krylov solver](krylov.h) in *mgp_history* and the
+number of iterations saved by the
+[extrapolation](implicit.h#extrapolated-initial-guess) of the initial
+guess in *mgp_guess.saved*.
 
 Wave breaking is parameterised usng the *breaking* parameter, which is
 turned off by default (see Section 3.6.4 in [Popinet,
@@ -45,6 +49,8 @@ See also the [general introduction](README). */
 
 scalar w, phi;
 mgstats mgp;
+Guess mgp_guess = {"mgp"};
+Array * mgp_history = NULL;
 double breaking = HUGE;
 
 
@@ -53,7 +59,13 @@ double breaking = HUGE;
 ## Setup
 
 The $w_k$ and $\phi_k$ scalar fields are allocated and the $w_k$ are
-added to the list of advected tracers. */
+added to the list of advected tracers. The vertical velocity is also
+added to the list of fields [diffused
+vertically](cap_diffusion.h#diffusion-of-several-fields) with the
+horizontal velocity, with the top boundary value stored in
+*w_top*. */
+
+scalar w_top;
 
 event defaults (i = 0)
 {
@@ -67,46 +79,35 @@ event defaults (i = 0)
 
   if (!linearised)
     tracers = list_append (tracers, w);
+
+  w_top = new scalar;
+  vertical_diffusion_add ((VDiffusion){w, vd_NavierNavier,
+	w_top, zeroc, zeroc, zeroc});
 }
 
 /**
 ## Viscous term
 
 Vertical diffusion is added to the vertical component of velocity
-$w$. */
+$w$. This event only computes the top boundary condition, the
+diffusion itself is done by the [viscous
+term](cap_diffusion.h#viscous-friction-between-layers) of the
+horizontal velocity. */
 
 event viscous_term (i++)
 {
   if (nu > 0.){
-    scalar dwt[];
-    scalar wt[];
-    scalar eta_star[];
+    scalar wt = w_top;
+    scalar eta_star = depth;
     
     foreach(){
-      eta_star[] = 0; 
-      foreach_layer(){
-	eta_star[]+=h[];
-      }
-    }
-    foreach(){
-      dwt[]=0;
       wt[]=(w[0,0,nl-1]+w[0,0,nl-2])/2.;
       foreach_dimension(){
-      	dwt[] -= (u.x[1,0,nl-1] - u.x[1,0,nl-1] + h[1,0,nl-1]/2*dut.x[1,0] - h[-1,0,nl-1]/2*dut.x[-1,0])/(2.*Delta);
 	wt[] -= (u.x[1,0,nl-1]*h[1,0,nl-1]-u.x[-1,0,nl-1]*h[-1,0,nl-1])/(2.*Delta);
 	wt[] += (u.x[0,0,nl-1]+ h[0,0,nl-1]/2*dut.x[0,0])*(eta_star[1,0]-eta_star[-1,0])/(2.*Delta);
 	wt[] -= (u.x[0,0,nl-1]+u.x[0,0,nl-2])/2.*(eta_star[1,0]-h[1,0,nl-1]-eta_star[-1,0]+h[-1,0,nl-1])/(2.*Delta);
       }
-      //fprintf(stderr,"%g\n",wt[]);
-      //vertical_diffusion_NeumanNavier (point, h, w, dt, nu, dwt[], 0., 0.);
-      vertical_diffusion_NavierNavier (point, h, w, dt, nu, wt[], 0., 0., 0.);
-      
-      //vertical_diffusion_NeumanNeuman (point, h, w, dt, nu,dwt[], dwt[]);
-      //vertical_diffusion (point, h, w, dt, nu, 0., 0., 0.);
     }
-    if (h_diffusion)
-      horizontal_diffusion_Navier ( w, nu, dt,wt);
-    //horizontal_diffusion_Neumann ( w, nu, dt,dwt);
   }
 }
 
@@ -137,7 +138,9 @@ where $\mathbf{\phi}$ is the vector of $\phi_l$ for this column and
 $\mathbf{d}$ is a vector dependent only on the values of $\phi$ in the
 neighboring columns. Note that in contrast with [Popinet,
 2020](/Bibliography#popinet2020), all the (metric) terms are
-retained. */
+retained.
+
+Only $\mathbf{d}$ is computed if *H* is `NULL`. */
 
 static void box_matrix (Point point, scalar phi, scalar rhs,
 			face vector hf, scalar eta,
@@ -149,42 +152,47 @@ static void box_matrix (Point point, scalar phi, scalar rhs,
   foreach_layer()
     foreach_dimension()
       dz.x += h[] - h[-1], dzp.x += h[1] - h[];
-  for (int l = 0, m = nl - 1; l < nl; l++, m--) {
+  for (int l = 0, m = NLAYERS - 1; l < NLAYERS; l++, m--) {
     double a = h[0,0,m]/(sq(Delta)*cm[]);
     d[l] = rhs[0,0,m];
-    for (int k = 0; k < nl; k++)
-      H[l*nl + k] = 0.;
+    if (H)
+      for (int k = 0; k < NLAYERS; k++)
+	H[l*NLAYERS + k] = 0.;
     foreach_dimension() {
-      //fprintf(stderr,"%g\n",eta[]);
       double s = Delta*slope_limited((dz.x - h[0,0,m] + h[-1,0,m])/Delta);
       double sp = Delta*slope_limited((dzp.x - h[1,0,m] + h[0,0,m])/Delta);
       d[l] -= a*(gmetric(0)*(h[-1,0,m] - s)*phi[-1,0,m] +
 		 gmetric(1)*(h[1,0,m] + sp)*phi[1,0,m] +
 		 2.*theta_H*Delta*(hf.x[0,0,m]*a_baro (eta, 0) -
 				   hf.x[1,0,m]*a_baro (eta, 1)));
-      H[l*nl + l] -= a*(gmetric(0)*(h[0,0,m] + s) +
-			gmetric(1)*(h[0,0,m] - sp));
+      if (H)
+	H[l*NLAYERS + l] -= a*(gmetric(0)*(h[0,0,m] + s) +
+			  gmetric(1)*(h[0,0,m] - sp));
     }
-    H[l*nl + l] -= 4.;
+    if (H)
+      H[l*NLAYERS + l] -= 4.;
     if (l > 0) {
-      H[l*(nl + 1) - 1] = 4.;
+      if (H)
+	H[l*(NLAYERS + 1) - 1] = 4.;
       foreach_dimension() {
         double s = Delta*slope_limited(dz.x/Delta);
         double sp = Delta*slope_limited(dzp.x/Delta);
 	d[l] -= a*(gmetric(0)*(h[-1,0,m] + s)*phi[-1,0,m+1] +
 		   gmetric(1)*(h[1,0,m] - sp)*phi[1,0,m+1]);
-	H[l*(nl + 1) - 1] -= a*(gmetric(0)*(h[0,0,m] - s) +
-				gmetric(1)*(h[0,0,m] + sp));
+	if (H)
+	  H[l*(NLAYERS + 1) - 1] -= a*(gmetric(0)*(h[0,0,m] - s) +
+				  gmetric(1)*(h[0,0,m] + sp));
       }
     }
-    for (int k = l + 1, s = -1; k < nl; k++, s = -s) {
-      double hk = h[0,0,nl-1-k];
-      if (hk > dry) {
-	//if (k<nl-1)
-	H[l*nl + k] -= 8.*s*h[0,0,m]/hk;
-	H[l*nl + k - 1] += 8.*s*h[0,0,m]/hk;
+    if (H)
+      for (int k = l + 1, s = -1; k < NLAYERS; k++, s = -s) {
+	double hk = h[0,0,NLAYERS-1-k];
+	if (hk > dry) {
+	  //if (k<nl-1)
+	  H[l*NLAYERS + k] -= 8.*s*h[0,0,m]/hk;
+	  H[l*NLAYERS + k - 1] += 8.*s*h[0,0,m]/hk;
+	}
       }
-    }
     foreach_dimension()
       dz.x -= h[0,0,m] - h[-1,0,m], dzp.x -= h[1,0,m] - h[0,0,m];
   }
@@ -195,11 +203,191 @@ static void box_matrix (Point point, scalar phi, scalar rhs,
 
 #include "hessenberg.h"
 
+/**
+The matrix $\mathbf{H}$ only depends on the layer thicknesses, the
+bathymetry and the metric, which do not change during the solution of
+the coupled system. When *nh_cache* is set, the (LU) factorisation of
+$\mathbf{H}$ is thus computed only once per timestep for each column
+(of each level) and stored in *nh_lu*, so that each relaxation only
+needs to compute $\mathbf{d}$ and to do the forward and backward
+substitutions. The cache is not used if its size would be larger than
+*nh_cache_max* bytes. It is taken from the [pool](pool.h), so that it
+is only allocated once. */
+
+bool nh_cache = false;
+double nh_cache_max = 1e9 [0];
+scalar nh_lu = {-1}, nh_luf = {-1};
+
+/**
+The LU factorisation of an upper Hessenberg matrix only requires the
+elimination of the subdiagonal, with partial pivoting between
+consecutive rows. The multipliers are stored in place of the
+subdiagonal and the row permutations in *p*. */
+
+static void factor_hessenberg (double * H, double * p, int n)
+{
+  for (int k = 0; k < n - 1; k++) {
+    double * r = H + k*n, * q = r + n;
+    p[k] = fabs(q[k]) > fabs(r[k]);
+    if (p[k])
+      for (int j = k; j < n; j++)
+	swap (double, r[j], q[j]);
+    double m = q[k]/r[k];
+    q[k] = m;
+    for (int j = k + 1; j < n; j++)
+      q[j] -= m*r[j];
+  }
+}
+
+static void solve_factored_hessenberg (const double * LU, const double * p,
+				       double * x, int n)
+{
+  for (int k = 0; k < n - 1; k++) {
+    if (p[k])
+      swap (double, x[k], x[k + 1]);
+    x[k + 1] -= LU[(k + 1)*n + k]*x[k];
+  }
+  for (int k = n - 1; k >= 0; k--) {
+    for (int j = k + 1; j < n; j++)
+      x[k] -= LU[k*n + j]*x[j];
+    x[k] /= LU[k*n + k];
+  }
+}
+
+/**
+When *nh_single* is set, the factorisation and the substitutions are
+done in single precision and the cache stores the factorisations as
+pairs of floats in each double, which halves its size and the memory
+traffic of the relaxation. The residual, computed by the [function
+below](#residual-computation), and the solution are still in double
+precision so that the multigrid iterations (which only need
+approximate relaxations) act as iterative refinement and the tolerance
+is still met. */
+
+bool nh_single = false;
+
+static void factor_hessenbergf (float * H, float * p, int n)
+{
+  for (int k = 0; k < n - 1; k++) {
+    float * r = H + k*n, * q = r + n;
+    p[k] = fabsf(q[k]) > fabsf(r[k]);
+    if (p[k])
+      for (int j = k; j < n; j++)
+	swap (float, r[j], q[j]);
+    float m = q[k]/r[k];
+    q[k] = m;
+    for (int j = k + 1; j < n; j++)
+      q[j] -= m*r[j];
+  }
+}
+
+static void solve_factored_hessenbergf (const float * LU, const float * p,
+					float * x, int n)
+{
+  for (int k = 0; k < n - 1; k++) {
+    if (p[k])
+      swap (float, x[k], x[k + 1]);
+    x[k + 1] -= LU[(k + 1)*n + k]*x[k];
+  }
+  for (int k = n - 1; k >= 0; k--) {
+    for (int j = k + 1; j < n; j++)
+      x[k] -= LU[k*n + j]*x[j];
+    x[k] /= LU[k*n + k];
+  }
+}
+
+/**
+The number of (double) blocks of the cache. */
+
+static int nh_lu_blocks()
+{
+  return nh_single ? (NLAYERS*NLAYERS + NLAYERS)/2 : NLAYERS*(NLAYERS + 1);
+}
+
+static void column_solve_single (Point point, scalar phi, scalar rhs,
+				 face vector hf, scalar eta, double * b)
+{
+  int n2 = NLAYERS*NLAYERS, nc = nh_lu_blocks();
+  float LU[n2 + NLAYERS], x[NLAYERS];
+  double c[nc];
+  if (nh_lu.i >= 0 && nh_luf[]) {
+    box_matrix (point, phi, rhs, hf, eta, NULL, b);
+    for (int k = 0; k < nc; k++)
+      c[k] = nh_lu[0,0,k];
+    memcpy (LU, c, (n2 + NLAYERS - 1)*sizeof(float));
+  }
+  else {
+    double H[n2];
+    box_matrix (point, phi, rhs, hf, eta, H, b);
+    for (int k = 0; k < n2; k++)
+      LU[k] = H[k];
+    factor_hessenbergf (LU, LU + n2, NLAYERS);
+    if (nh_lu.i >= 0) {
+      memcpy (c, LU, (n2 + NLAYERS - 1)*sizeof(float));
+      for (int k = 0; k < nc; k++)
+	nh_lu[0,0,k] = c[k];
+      nh_luf[] = 1.;
+    }
+  }
+  for (int k = 0; k < NLAYERS; k++)
+    x[k] = b[k];
+  solve_factored_hessenbergf (LU, LU + n2, x, NLAYERS);
+  for (int k = 0; k < NLAYERS; k++)
+    b[k] = x[k];
+}
+
+/**
+The function below returns the solution of $\mathbf{H}\mathbf{\phi} =
+\mathbf{d}$ in *b*, using the cache if it is allocated. For a single
+layer, $\mathbf{H}$ is a scalar and the solution is obtained directly
+(the cache is not used). */
+
+static void column_solve (Point point, scalar phi, scalar rhs,
+			  face vector hf, scalar eta, double * b)
+{
+  if (NLAYERS == 1) {
+    double H;
+    box_matrix (point, phi, rhs, hf, eta, &H, b);
+    b[0] /= H;
+    return;
+  }
+  if (nh_single) {
+    column_solve_single (point, phi, rhs, hf, eta, b);
+    return;
+  }
+  if (nh_lu.i < 0) {
+    double H[NLAYERS*NLAYERS];
+    box_matrix (point, phi, rhs, hf, eta, H, b);	
+    solve_hessenberg (H, b, NLAYERS);
+    return;
+  }
+  int n2 = NLAYERS*NLAYERS;
+  double LU[n2], p[NLAYERS];
+  if (nh_luf[]) {
+    box_matrix (point, phi, rhs, hf, eta, NULL, b);
+    for (int k = 0; k < n2; k++)
+      LU[k] = nh_lu[0,0,k];
+    for (int k = 0; k < NLAYERS - 1; k++)
+      p[k] = nh_lu[0,0,n2 + k];
+  }
+  else {
+    box_matrix (point, phi, rhs, hf, eta, LU, b);
+    factor_hessenberg (LU, p, NLAYERS);
+    for (int k = 0; k < n2; k++)
+      nh_lu[0,0,k] = LU[k];
+    for (int k = 0; k < NLAYERS - 1; k++)
+      nh_lu[0,0,n2 + k] = p[k];
+    nh_luf[] = 1.;
+  }
+  solve_factored_hessenberg (LU, p, b, NLAYERS);
+}
+
 face vector hf;
 
 trace
 static void relax_nh (scalar * phil, scalar * rhsl, int lev, void * data)
 {
+  profile_start (PROF_RELAX_NH);
   scalar phi = phil[0], rhs = rhsl[0];
   scalar eta = phil[1], rhs_eta = rhsl[1];
   face vector alpha = *((vector *)data);
@@ -213,12 +401,16 @@ static void relax_nh (scalar * phil, scalar * rhsl, int lev, void * data)
     were $\mathbf{H}$ and $\mathbf{b}$ are the Hessenberg matrix and
     vector constructed by the function above. */
 
-    double H[nl*nl], b[nl];
-    box_matrix (point, phi, rhs, hf, eta, H, b);	
-    solve_hessenberg (H, b, nl);
-    int l = nl - 1;
-    foreach_layer()
-      phi[] = b[l--];
+    if (wet_column()) {
+      double b[NLAYERS];
+      column_solve (point, phi, rhs, hf, eta, b);
+      int l = NLAYERS - 1;
+      foreach_layer()
+	phi[] = b[l--];
+    }
+    else
+      foreach_layer()
+	phi[] = 0.;
 
 
     /**
@@ -245,6 +437,7 @@ static void relax_nh (scalar * phil, scalar * rhsl, int lev, void * data)
     }
     eta[] = n/d;
   }
+  profile_stop (PROF_RELAX_NH);
 }
 
 /**
@@ -254,11 +447,12 @@ trace
 static double residual_nh (scalar * phil, scalar * rhsl,
 			   scalar * resl, void * data)
 {
+  profile_start (PROF_RESIDUAL_NH);
   scalar phi = phil[0], rhs = rhsl[0], res = resl[0];
   scalar eta = phil[1], rhs_eta = rhsl[1], res_eta = resl[1];
   double maxres = 0.;
 
-  face vector g = new face vector[nl];
+  face vector g = pool_face_vector (nl);
   foreach_face() {
     double pgh = theta_H*a_baro (eta, 0);
     hpg (pg, phi, 0,
@@ -320,7 +514,8 @@ static double residual_nh (scalar * phil, scalar * rhsl,
         res_eta[] += theta_H*sq(dt)/2.*(g.x[1] - g.x[])/(Delta*cm[]);
   }
 
-  delete ((scalar *){g});
+  pool_release ((scalar *){g});
+  profile_stop (PROF_RESIDUAL_NH);
   return maxres;
 }
 
@@ -375,7 +570,7 @@ event pressure (i++)
   of `hu`. Note also that the slope limiter will break Galilean
   invariance. */
 
-  scalar rhs = new scalar[nl];
+  scalar rhs = pool_scalar (nl);
   double h1 = 0., v1 = 0.;
   foreach (reduction(+:h1) reduction(+:v1)) {
     coord dz;
@@ -406,14 +601,46 @@ event pressure (i++)
 
   scalar res;
   if (res_eta.i >= 0)
-    res = new scalar[nl];
-  mgp = mg_solve ({phi,eta}, {rhs,rhs_eta}, residual_nh, relax_nh, &alpha_eta,
-		  res = res_eta.i >= 0 ? (scalar *){res,res_eta} : NULL,
-		  nrelax = 4, minlevel = 1,
-		  tolerance = TOLERANCE*sq(h1/(dt*v1)));
-  delete ({rhs});
+    res = pool_scalar (nl);
+
+  /**
+  The cache of the [factorisations](#relaxation-operator) is allocated
+  on all levels, if required and if its size is not too large. */
+  
+  if (nh_cache && NLAYERS > 1 &&
+      (nh_lu_blocks() + 1.)*sizeof(double)*grid->n*
+      (1. + 1./((1 << dimension) - 1.)) <= nh_cache_max) {
+    nh_lu = pool_scalar (nh_lu_blocks());
+    nh_luf = pool_scalar (1);
+    reset ({nh_luf}, 0.);
+  }
+  guess_extrapolate (&mgp_guess, {phi,eta}, t + dt);
+  int minlevel = mg_coupling > 0. ? coupling_minlevel (alpha_eta, true, 1) : 1;
+  if (krylov) {
+    if (!mgp_history)
+      mgp_history = array_new();
+    mgp = krylov_solve ({phi,eta}, {rhs,rhs_eta}, residual_nh, relax_nh,
+			&alpha_eta,
+			res = res_eta.i >= 0 ? (scalar *){res,res_eta} : NULL,
+			nrelax = 4, minlevel = minlevel,
+			tolerance = TOLERANCE*sq(h1/(dt*v1)),
+			history = mgp_history);
+  }
+  else
+    mgp = mg_solve ({phi,eta}, {rhs,rhs_eta}, residual_nh, relax_nh,
+		    &alpha_eta,
+		    res = res_eta.i >= 0 ? (scalar *){res,res_eta} : NULL,
+		    nrelax = 4, minlevel = minlevel,
+		    tolerance = TOLERANCE*sq(h1/(dt*v1)));
+  profile_solver (PROF_MGP, mgp);
+  guess_update (&mgp_guess, mgp, t + dt);
+  pool_release ({rhs});
   if (res_eta.i >= 0)
-    delete ({res});
+    pool_release ({res});
+  if (nh_lu.i >= 0) {
+    pool_release ({nh_lu, nh_luf});
+    nh_lu.i = nh_luf.i = -1;
+  }
 
   /**
   The non-hydrostatic pressure gradient is added to the face-weighted
@@ -449,10 +676,7 @@ event pressure (i++)
   foreach() {
     double wmax = HUGE;
     if (breaking < HUGE) {
-      wmax = 0.;
-      foreach_layer()
-	wmax += h[];
-      wmax = wmax > 0. ? breaking*sqrt(G*wmax) : 0.;
+      wmax = depth[] > 0. ? breaking*sqrt(G*depth[]) : 0.;
     }
     foreach_layer()
       if (h[] > dry) {
@@ -482,5 +706,8 @@ event pressure (i++)
 The *w* and *phi* fields are freed. */
       
 event cleanup (i = end, last) {
-  delete ({w, phi});
+  guess_free (&mgp_guess);
+  if (mgp_history)
+    array_free (mgp_history), mgp_history = NULL;
+  delete ({w, phi, w_top});
 }
@@ -0,0 +1,200 @@
+/**
+# Pool of temporary fields
+
+Several fields are allocated and freed at each timestep (or at each
+call of a residual function). The functions below keep such fields in
+a pool, indexed by their type (scalar, vector or face vector) and
+number of blocks (i.e. layers), so that they are reused rather than
+reallocated.
+
+A field is obtained using one of the *pool_xxx()* functions and
+returned to the pool using *pool_release()*, which replaces
+*delete()*. Pooled fields are normal fields, they are thus resized
+when the grid is adapted but their values must not be used before
+they are (re)initialised, as for new fields. They are not dumped. The
+pool is freed by *pool_free()*.
+
+The attributes which can be modified by the users of a field (the
+refinement, prolongation and restriction functions, the gradient and
+the boundary conditions) are stored when the field is created and are restored each time it is
+obtained from the pool, so that a field has the default attributes of
+a new field. The fields which are not in use have "empty" refinement
+and restriction functions, so that they are not refined or coarsened
+by mesh adaptation. */
+
+typedef double (* PoolBoundary) (Point, Point, scalar, bool *);
+
+typedef struct {
+#if TREE
+  void (* refine) (Point, scalar);
+  void (* prolongation) (Point, scalar);
+  void (* restriction) (Point, scalar);
+#endif
+  double (* gradient) (double, double, double);
+  int nb; // the number of boundaries when the field was created
+  PoolBoundary * boundary, * boundary_homogeneous;
+} PoolAttributes;
+
+typedef struct {
+  int type, block; // 0: scalar, 1: vector, 2: face vector
+  bool busy;
+  vector v;
+  PoolAttributes a[dimension]; // the default attributes of each component
+} PoolField;
+
+static PoolField * pool = NULL;
+static int pool_len = 0;
+
+static int pool_ncomp (int type)
+{
+  return type ? dimension : 1;
+}
+
+static void pool_attributes (PoolField * f, bool busy)
+{
+  scalar * c = (scalar *) &f->v;
+  for (int d = 0; d < pool_ncomp (f->type); d++) {
+    scalar s = c[d];
+    PoolAttributes * a = f->a + d;
+#if TREE
+    if (busy)
+      s.refine = a->refine, s.prolongation = a->prolongation,
+	s.restriction = a->restriction;
+    else
+      s.refine = s.prolongation = s.restriction = no_restriction;
+#endif
+    s.gradient = a->gradient;
+    for (int k = 0; k < max (f->block, 1); k++) {
+      scalar b = {s.i + k};
+      for (int j = 0; j < a->nb; j++)
+	b.boundary[j] = a->boundary[j],
+	  b.boundary_homogeneous[j] = a->boundary_homogeneous[j];
+    }
+    s.dirty = true;
+  }
+  f->busy = busy;
+}
+
+static vector pool_get (int type, int block)
+{
+  for (int i = 0; i < pool_len; i++)
+    if (!pool[i].busy && pool[i].type == type && pool[i].block == block) {
+      pool_attributes (pool + i, true);
+      return pool[i].v;
+    }
+  vector v;
+  if (type == 0) {
+    if (block > 1) {
+      scalar s = new scalar[block];
+      v.x = s;
+    }
+    else {
+      scalar s = new scalar;
+      v.x = s;
+    }
+  }
+  else if (type == 1) {
+    if (block > 1) {
+      vector u = new vector[block];
+      v = u;
+    }
+    else {
+      vector u = new vector;
+      v = u;
+    }
+  }
+  else {
+    if (block > 1) {
+      face vector u = new face vector[block];
+      v = u;
+    }
+    else {
+      face vector u = new face vector;
+      v = u;
+    }
+  }
+  pool = qrealloc (pool, pool_len + 1, PoolField);
+  PoolField * f = pool + pool_len++;
+  *f = (PoolField){type, block, true, v};
+  scalar * c = (scalar *) &v;
+  for (int d = 0; d < pool_ncomp (type); d++) {
+    scalar s = c[d];
+    s.nodump = true;
+#if TREE
+    f->a[d].refine = s.refine, f->a[d].prolongation = s.prolongation;
+    f->a[d].restriction = s.restriction;
+#endif
+    f->a[d].gradient = s.gradient;
+    f->a[d].nb = nboundary;
+    f->a[d].boundary = qmalloc (nboundary, PoolBoundary);
+    f->a[d].boundary_homogeneous = qmalloc (nboundary, PoolBoundary);
+    for (int j = 0; j < nboundary; j++)
+      f->a[d].boundary[j] = s.boundary[j],
+	f->a[d].boundary_homogeneous[j] = s.boundary_homogeneous[j];
+  }
+  return v;
+}
+
+scalar pool_scalar (int block)
+{
+  return pool_get (0, block).x;
+}
+
+vector pool_vector (int block)
+{
+  return pool_get (1, block);
+}
+
+vector pool_face_vector (int block)
+{
+  return pool_get (2, block);
+}
+
+/**
+The function below returns a list of pooled scalars with the same
+numbers of blocks as those of *list* and with their boundary
+conditions (or their homogeneous boundary conditions if *homogeneous*
+is *true*). It replaces *list_clone()* for temporary lists (the other
+attributes are those of new fields). */
+
+scalar * pool_clone (scalar * list, bool homogeneous)
+{
+  scalar * c = NULL;
+  for (scalar s in list) {
+    scalar t = pool_scalar (max (s.block, 1));
+    for (int k = 0; k < max (s.block, 1); k++) {
+      scalar a = {s.i + k}, b = {t.i + k};
+      for (int j = 0; j < nboundary; j++)
+	b.boundary[j] = homogeneous ? a.boundary_homogeneous[j] : a.boundary[j],
+	  b.boundary_homogeneous[j] = a.boundary_homogeneous[j];
+    }
+    c = list_append (c, t);
+  }
+  return c;
+}
+
+void pool_release (scalar * list)
+{
+  for (scalar s in list)
+    for (int i = 0; i < pool_len; i++) {
+      scalar * c = (scalar *) &pool[i].v;
+      for (int d = 0; d < pool_ncomp (pool[i].type); d++)
+	if (c[d].i == s.i && pool[i].busy)
+	  pool_attributes (pool + i, false);
+    }
+}
+
+void pool_free()
+{
+  for (int i = 0; i < pool_len; i++) {
+    scalar * c = (scalar *) &pool[i].v, * list = NULL;
+    for (int d = 0; d < pool_ncomp (pool[i].type); d++) {
+      list = list_append (list, c[d]);
+      free (pool[i].a[d].boundary);
+      free (pool[i].a[d].boundary_homogeneous);
+    }
+    delete (list), free (list);
+  }
+  free (pool), pool = NULL;
+  pool_len = 0;
+}
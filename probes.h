@@ -0,0 +1,177 @@
+/**
+# Vertical profiles at probes
+
+This is a layer-aware version of [gauges](/src/gauges.h), to sample
+vertical profiles at high frequency. A NULL-terminated array of
+*Probe* structures (with a name, a position and an optional
+description) is passed to *output_probes()* together with the list of
+fields to sample, for example
+
+~~~literatec
+Probe probes[] = {
+  {"center", 0.5, 0.5},
+  {"wall", 0.99, 0.5, "close to the right wall"},
+  {NULL}
+};
+
+event sample (i++)
+  output_probes (probes, {u.x, w, phi});
+~~~
+
+The cell containing each probe is located once, on the process which
+owns it, and is only located again after the grid is
+[adapted](hydro.h#mesh-changes). Each
+record contains the time, the $n_l + 1$ heights of the layer
+interfaces (reconstructed from $z_b$ and the cumulative layer
+thicknesses) and the (linearly interpolated) values of the fields, for
+each layer (or a single value for fields which are not layered, such
+as $\eta$).
+
+The records are stored in a buffer of *probe_buffer* records and
+written in binary (double precision) when it is full, so that the
+cost of output does not depend on the sampling frequency. If
+*probe_average* is larger than one, each record is the average of
+*probe_average* consecutive samples. The file of each probe starts
+with a line of text describing the record, followed by the binary
+records. The buffers must be written by *free_probes()* at the end of
+the run. */
+
+typedef struct {
+  char * name;
+  double x, y;
+  char * desc;
+  FILE * fp;
+  Point point;
+  bool local, opened;
+  int generation, n, navg;
+  double * buf, * avg;
+} Probe;
+
+int probe_buffer = 1024, probe_average = 1;
+
+static int probe_size (scalar * list)
+{
+  int n = 1 + nl + 1;
+  for (scalar s in list)
+    n += s.block;
+  return n;
+}
+
+static void probe_write (Probe * p)
+{
+  if (p->n > 0) {
+    fwrite (p->buf, sizeof(double), p->n, p->fp);
+    p->n = 0;
+  }
+}
+
+static void probe_close (Probe * p)
+{
+  if (p->fp)
+    probe_write (p), fclose (p->fp), p->fp = NULL;
+  free (p->buf), p->buf = NULL;
+  free (p->avg), p->avg = NULL;
+  p->navg = 0, p->local = false;
+}
+
+/**
+When the grid is adapted, only the position of the cell containing
+the probe is updated: the file, the buffer and the running average are
+kept. If the probe moves to another process, the buffered records are
+written (and the file is closed) by the previous owner, and the
+running average is transferred to the new owner (which then appends
+to the file). */
+
+static void probe_locate (Probe * p, scalar * list)
+{
+  int size = probe_size (list);
+  Point point = locate (p->x, p->y);
+  bool local = (point.level >= 0);
+  if (!p->avg)
+    p->avg = qcalloc (size, double);
+  if (p->local && !local && p->fp) {
+    probe_write (p);
+    fclose (p->fp), p->fp = NULL;
+  }
+#if _MPI
+  if (p->opened) {
+    MPI_Allreduce (MPI_IN_PLACE, p->avg, size, MPI_DOUBLE, MPI_SUM,
+		   MPI_COMM_WORLD);
+    MPI_Allreduce (MPI_IN_PLACE, &p->navg, 1, MPI_INT, MPI_MAX,
+		   MPI_COMM_WORLD);
+    if (!local) {
+      for (int j = 0; j < size; j++)
+	p->avg[j] = 0.;
+      p->navg = 0;
+    }
+  }
+#endif
+  p->point = point;
+  p->local = local;
+  p->generation = grid_generation;
+  if (local) {
+    if (!p->fp) {
+      p->fp = fopen (p->name, p->opened ? "a" : "w");
+      if (!p->opened) {
+	fprintf (p->fp, "# %s at %g,%g: t z[0..%d]", p->name, p->x, p->y, nl);
+	for (scalar s in list)
+	  fprintf (p->fp, " %s[%d]", s.name, s.block);
+	if (p->desc)
+	  fprintf (p->fp, " (%s)", p->desc);
+	fputc ('\n', p->fp);
+      }
+    }
+    if (!p->buf)
+      p->buf = qmalloc (size*max (probe_buffer, 1), double);
+  }
+  p->opened = true;
+}
+
+void output_probes (Probe * probes, scalar * list)
+{
+  int size = probe_size (list);
+
+  /**
+  The fields are interpolated outside of any *foreach()* loop, so that
+  their ghost values must be updated first. */
+  
+  boundary ({zb, h});
+  boundary (list);
+  for (Probe * p = probes; p->name; p++) {
+    if (!p->opened || p->generation != grid_generation)
+      probe_locate (p, list);
+    if (p->local) {
+      Point point = p->point;
+      double * a = p->avg, xp = p->x, yp = p->y;
+      int k = 0;
+      a[k++] += t;
+      double z = interpolate_linear (point, zb, xp, yp, 0.);
+      a[k++] += z;
+      foreach_layer() {
+	z += interpolate_linear (point, h, xp, yp, 0.);
+	a[k++] += z;
+      }
+      for (scalar s in list)
+	if (s.block > 1)
+	  foreach_layer()
+	    a[k++] += interpolate_linear (point, s, xp, yp, 0.);
+	else
+	  a[k++] += interpolate_linear (point, s, xp, yp, 0.);
+      if (++p->navg >= probe_average) {
+	double * r = p->buf + p->n;
+	for (int j = 0; j < size; j++)
+	  r[j] = a[j]/p->navg, a[j] = 0.;
+	p->navg = 0;
+	p->n += size;
+	if (p->n >= size*max (probe_buffer, 1))
+	  probe_write (p);
+      }
+    }
+  }
+}
+
+void free_probes (Probe * probes)
+{
+  for (Probe * p = probes; p->name; p++)
+    probe_close (p);
+}
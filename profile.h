@@ -0,0 +1,160 @@
+/**
+# Profiling of the multilayer solver
+
+When *LAYERED_PROFILE* is defined (e.g. with `-DLAYERED_PROFILE=1`),
+the wall-clock time spent in each event of the [multilayer
+solver](hydro.h) and in its main kernels is accumulated, together with
+the number of calls, multigrid cycles and residual reductions of the
+[implicit](implicit.h) and [non-hydrostatic](nh.h) solvers.
+
+Every *profile_interval* timesteps, one line per event/kernel is
+appended to the CSV file *profile_file* (by the master process). The
+columns are the timestep, the time, the name, the number of calls, the
+average, minimum and maximum (over MPI processes) of the wall-clock
+time and, for the solvers, the number of cycles and the residual
+reduction (in decades) summed over the interval. The maximum/average
+ratio is thus a measure of the load imbalance.
+
+The time of an event is measured as the time between the end of the
+(last) event of the same name of the multilayer solver and the end of
+the previous one. It thus includes the time spent in the events of the
+same name of the other modules (and in any event, such as
+*stability*, defined between them). The time of the user events
+(outputs etc.) is accounted for in *other*.
+
+The timers are only called outside the loops (i.e. by the master
+thread), around whole-grid operations, so that their overhead is
+negligible. When *LAYERED_PROFILE* is not defined, the macros below do
+nothing. */
+
+enum {
+  PROF_OTHER, PROF_FACE_FIELDS, PROF_HALF_ADVECTION, PROF_VISCOUS_TERM,
+  PROF_ACCELERATION, PROF_PRESSURE, PROF_UPDATE_ETA, PROF_REMAP, PROF_ADAPT,
+  PROF_ADVECT, PROF_VERTICAL_DIFFUSION, PROF_HORIZONTAL_DIFFUSION,
+  PROF_RELAX_HYDRO, PROF_RESIDUAL_HYDRO, PROF_RELAX_NH, PROF_RESIDUAL_NH,
+  PROF_MGH, PROF_MGP, PROF_FLUX_LIMIT, PROF_NEGATIVE_H,
+  PROF_N
+};
+
+#if LAYERED_PROFILE
+
+int profile_interval = 10;
+char * profile_file = "profile.csv";
+
+static const char * profile_names[PROF_N] = {
+  "other", "face_fields", "half_advection", "viscous_term",
+  "acceleration", "pressure", "update_eta", "remap", "adapt",
+  "advect", "vertical_diffusion", "horizontal_diffusion",
+  "relax_hydro", "residual_hydro", "relax_nh", "residual_nh",
+  "mgH", "mgp", "flux_limit", "negative_h"
+};
+
+static struct {
+  double t, start, reduction;
+  long calls, cycles;
+} profile_data[PROF_N];
+
+static timer profile_clock;
+static double profile_last = -1.;
+static int profile_steps = 0;
+static FILE * profile_fp = NULL;
+
+static double profile_now()
+{
+  if (profile_last < 0.)
+    profile_clock = timer_start(), profile_last = 0.;
+  return timer_elapsed (profile_clock);
+}
+
+# define profile_start(k) (profile_data[k].start = profile_now())
+# define profile_stop(k)						\
+  (profile_data[k].t += profile_now() - profile_data[k].start,		\
+   profile_data[k].calls++)
+
+/**
+The solver statistics are added by *profile_solver()*. */
+
+# define profile_solver(k, s)						\
+  (profile_data[k].calls++, profile_data[k].cycles += (s).i,		\
+   profile_data[k].reduction += (s).resa > 0. && (s).resb > 0. ?	\
+   log10 ((s).resb/(s).resa) : 0.)
+
+/**
+The number of (already reduced) [advection
+diagnostics](hydro.h#diagnostics) is added by *profile_count()*, in
+the *cycles* column. */
+
+# define profile_count(k, n) (profile_data[k].calls++,		\
+			      profile_data[k].cycles += (n))
+
+/**
+The statistics are reduced over the MPI processes (in a single
+reduction for each operation) and written every *profile_interval*
+timesteps by *profile_output()*, called at the beginning of each
+timestep. */
+
+static void profile_output()
+{
+  double tmin[PROF_N], tmax[PROF_N], tsum[PROF_N];
+  for (int k = 0; k < PROF_N; k++)
+    tmin[k] = tmax[k] = tsum[k] = profile_data[k].t;
+#if _MPI
+  MPI_Allreduce (MPI_IN_PLACE, tmin, PROF_N, MPI_DOUBLE, MPI_MIN,
+		 MPI_COMM_WORLD);
+  MPI_Allreduce (MPI_IN_PLACE, tmax, PROF_N, MPI_DOUBLE, MPI_MAX,
+		 MPI_COMM_WORLD);
+  MPI_Allreduce (MPI_IN_PLACE, tsum, PROF_N, MPI_DOUBLE, MPI_SUM,
+		 MPI_COMM_WORLD);
+  for (int k = 0; k < PROF_N; k++)
+    tsum[k] /= npe();
+#endif
+  if (pid() == 0) {
+    if (!profile_fp) {
+      profile_fp = fopen (profile_file, "w");
+      fprintf (profile_fp,
+	       "i,t,name,calls,avg,min,max,cycles,reduction\n");
+    }
+    for (int k = 0; k < PROF_N; k++)
+      if (profile_data[k].calls)
+	fprintf (profile_fp, "%d,%g,%s,%ld,%g,%g,%g,%ld,%g\n",
+		 i, t, profile_names[k], profile_data[k].calls,
+		 tsum[k], tmin[k], tmax[k],
+		 profile_data[k].cycles, profile_data[k].reduction);
+    fflush (profile_fp);
+  }
+  for (int k = 0; k < PROF_N; k++)
+    profile_data[k].t = profile_data[k].reduction = 0.,
+      profile_data[k].calls = profile_data[k].cycles = 0;
+  profile_steps = 0;
+}
+
+/**
+The time of the event *k* is measured by *profile_event()*, which is
+called at the end of the (last) event of this name. The first event
+of the timestep is [set_dtmax](hydro.h#set_dtmax). */
+
+static void profile_event (int k)
+{
+  double now = profile_now();
+  profile_data[k].t += now - profile_last, profile_data[k].calls++;
+  profile_last = now;
+  if (k == PROF_OTHER && ++profile_steps >= profile_interval)
+    profile_output();
+}
+
+void profile_free()
+{
+  if (profile_fp)
+    fclose (profile_fp), profile_fp = NULL;
+}
+
+#else // !LAYERED_PROFILE
+
+# define profile_start(k)
+# define profile_stop(k)
+# define profile_solver(k, s)
+# define profile_count(k, n)
+# define profile_event(k)
+# define profile_free()
+
+#endif // !LAYERED_PROFILE
@@ -1,9 +1,79 @@
-
 double HAM = 1e-10;
-  
-#define a_VdW(eta,i) (-HAM*(pow(2.*eta[i],-3)-pow(2.*eta[i-1],-3))/Delta )
+
+/**
+When *VDW_FIELD* (or *VDW_IMPLICIT*) is defined, the disjoining
+pressure
+$$
+\Pi = - \frac{A}{(2\eta)^3}
+$$
+is computed once per timestep (in the *face_fields* event below),
+using multiplications only, and stored in the field *Pi* (taken from
+the [pool](pool.h) for the duration of the timestep), so that the van
+der Waals acceleration is just a difference of this field. In both
+cases, the acceleration includes the metric factor of the gradients,
+as the barotropic and capillary accelerations.
+
+When *VDW_IMPLICIT* is defined, the disjoining pressure is also
+linearised around $\eta^n$
+$$
+\Pi(\eta) \approx \Pi(\eta^n) + \Pi'(\eta^n)(\eta - \eta^n)
+$$
+and the linear part $\Pi'(\eta^n)\eta$ is added to the barotropic
+pressure, so that it is treated implicitly by the Poisson--Helmholtz
+solvers of the [implicit](/src/layered/implicit.h) and
+[non-hydrostatic](/src/layered/nh.h) schemes. The remainder
+$\Pi(\eta^n) - \Pi'(\eta^n)\eta^n$ is stored in *Pi* and remains
+explicit. */
+
+#if VDW_IMPLICIT && !defined(VDW_FIELD)
+# define VDW_FIELD 1
+#endif
+
+#if VDW_FIELD
+scalar Pi = {-1}, dPi = {-1};
+# define a_VdW(eta,i) (gmetric(i)*(Pi[i] - Pi[i-1])/Delta)
+# if VDW_IMPLICIT
+#  define p_VdW(eta,i) (dPi[i]*eta[i])
+# endif
+#else
+#define a_VdW(eta,i) (-HAM*gmetric(i)*(pow(2.*eta[i],-3)-pow(2.*eta[i-1],-3))/Delta )
+#endif
 //#define a_VdW(eta,i) (-HAM*(pow(2.*eta[i+1],-3)-pow(2.*eta[i-1],-3))/(2.*Delta))
 //#define a_VdW(eta,i) (3*HAM*pow(2.*eta[i],-4)*2.*(eta[i]-eta[i-1])/(Delta))
 //#define a_VdW(eta,i) (3*HAM*pow(2.*eta[i],-4)*(eta[i+1]-eta[i-1])/(Delta))
 
 #include "./hydro-tension.h"
+
+#if VDW_FIELD
+event face_fields (i++)
+{
+  Pi = pool_scalar (1);
+#if VDW_IMPLICIT
+  dPi = pool_scalar (1);
+#endif
+  foreach() {
+    double e = 2.*eta[], e3 = e*e*e;
+    Pi[] = - HAM/e3;
+#if VDW_IMPLICIT
+    dPi[] = 6.*HAM/(e3*e);
+    Pi[] -= dPi[]*eta[];
+#endif
+  }
+#if VDW_IMPLICIT
+  restriction_defer ({dPi});
+#endif
+}
+
+/**
+The fields are returned to the pool at the end of the timestep. */
+
+event update_eta (i++)
+{
+  pool_release ({Pi});
+  Pi.i = -1;
+#if VDW_IMPLICIT
+  pool_release ({dPi});
+  dPi.i = -1;
+#endif
+}
+#endif // VDW_FIELD
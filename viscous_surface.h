@@ -58,7 +58,7 @@ event acceleration (i++)
   2020](/Bibliography#popinet2020)). This gives the following vertical
   discrete integration scheme. */
   if (visc_activate){
-    scalar phiNu = new scalar[nl];
+    scalar phiNu = pool_scalar (nl);
     foreach(){
       double phiNu0 = 0.;
       double etax=0;
@@ -69,7 +69,6 @@ event acceleration (i++)
       foreach_layer()
         phiNu[] = phiNu0;
     }
-    boundary ({phiNu});
 
     /**
     Once the pressure deviation is known, the terms in blue above are
@@ -80,9 +79,8 @@ event acceleration (i++)
       //double pg;
       hpg_2(pg, phiNu, 0, ha.x[] += pg);
     }
-    boundary ((scalar *){ha});
   
-    delete ({phiNu});
+    pool_release ({phiNu});
   }
 }
 
@@ -127,23 +125,15 @@ event viscous_term (i++)
 event viscous_term (i++) 
 {
   if (visc_activate){
-    double etax=0;
     double maxdiff=1.;
     int iter=0;
 
-    scalar wt[];
-    scalar eta_star[];
+    scalar wt = pool_scalar (1);
+    scalar eta_star = depth;
     
     foreach()
       foreach_dimension ()
         du_nu.x[]=0;
-
-    foreach(){
-      eta_star[] = 0; 
-      foreach_layer(){
-	eta_star[]+=h[];
-      }
-    }
     
     while(iter<10){
       maxdiff=0.;
@@ -159,7 +149,7 @@ event viscous_term (i++)
       foreach()
 	foreach_dimension ()
 	{
-	  etax=(eta_star[1]-eta_star[-1])/(2.*Delta);
+	  double etax=(eta_star[1]-eta_star[-1])/(2.*Delta);
 	  du_nu.x[] = - (wt[1,0,nl-1] - wt[-1,0,nl-1])/(2.*Delta) + 4.*(u.x[1,0,nl-1] - u.x[-1,0,nl-1])/(2.*Delta)*etax/(1.-etax*etax);
 	    //(h[1,0,nl-1]*u.x[1,0,nl-1]-(h[1,0,nl-1]+h[0,0,nl-1])*u.x[0,0,nl-1]+h[0,0,nl-1]*u.x[-1,0,nl-1])/(2.*sq(Delta))+
 	    //tstress_a(h,eta,0)*du_nu.x[1] + tstress_c(h,eta,0)*du_nu.x[-1]-tstress_b(h,eta,0)*du_nu.x[];
@@ -169,7 +159,7 @@ event viscous_term (i++)
 	}
       iter++;
     }
-    boundary ((scalar *){du_nu});
+    pool_release ({wt});
     dut = du_nu;
   }
 }
@@ -190,11 +180,10 @@ event viscous_term (i++)
 event viscous_term (i++) 
 {
   if (visc_activate){
-    double etax=0;
     double maxdiff=1.;
     int iter=0;
 
-    scalar QED[];
+    scalar QED = pool_scalar (nl);
     vertical_velocity(QED,hu,hf);
     
     foreach()
@@ -205,7 +194,7 @@ event viscous_term (i++)
       foreach()
 	foreach_dimension ()
 	{
-	  etax=(eta[1]-eta[-1])/(2.*Delta);
+	  double etax=(eta[1]-eta[-1])/(2.*Delta);
 	  du_nu.x[] =  -(QED[1,0,nl-1]-QED[-1,0,nl-1])/(2.*Delta)  + 4.*(u.x[1,0,nl-1] - u.x[-1,0,nl-1])/(2.*Delta)*etax/(1.-etax*etax);
 	    //(h[1,0,nl-1]*u.x[1,0,nl-1]-(h[1,0,nl-1]+h[0,0,nl-1])*u.x[0,0,nl-1]+h[0,0,nl-1]*u.x[-1,0,nl-1])/(2.*sq(Delta))+
 	    //tstress_a(h,eta,0)*du_nu.x[1] + tstress_c(h,eta,0)*du_nu.x[-1]-tstress_b(h,eta,0)*du_nu.x[];
@@ -215,7 +204,7 @@ event viscous_term (i++)
 	}
       iter=10;
     }
-    boundary ((scalar *){du_nu});
+    pool_release ({QED});
     dut = du_nu;
   }
 }